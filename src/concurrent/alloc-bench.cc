@@ -0,0 +1,79 @@
+// ml:ccf += -pthread
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include "../util/allocations.hh"
+#include "../util/timer.hh"
+#include "../util/throughput.hh"
+#include "trie.hh"
+
+// the heap allocations of the concurrent trie, counted by util::allocations,
+// and its insert throughput, with nodes from the heap and from node_pool: n
+// keys in a random order split over threads threads, then removed again,
+// for every thread count up to max threads. the trie is new for every
+// count, the node pool keeps the blocks of the last one.
+//
+// usage: alloc-bench [keys] [max threads]
+
+template <class F>
+void measure(std::string const& name, std::vector<int> const& keys, int threads, F&& fn)
+{
+    auto n = static_cast<int>(keys.size());
+    auto calls = util::allocations.load();
+    util::timer t;
+    t.start();
+    std::vector<std::thread> workers;
+    for (auto id = 0; id < threads; id++)
+        workers.emplace_back([&, id] {
+            for (auto i = id; i < n; i += threads)
+                fn(keys[i]);
+        });
+    for (auto& w : workers)
+        w.join();
+    t.stop();
+    calls = util::allocations.load() - calls;
+    std::cout << "    " << std::setw(2) << threads << " threads " << std::left << std::setw(7)
+        << name << std::right << std::fixed << std::setprecision(3)
+        << n / t.elapsed_seconds() / 1e6 << " Mops/s, "
+        << static_cast<double>(calls) / n << " allocations/key, "
+        << static_cast<double>(concurrent::node_pool::reserved.load()) / (1 << 20)
+        << " MB in the node pool\n" << std::defaultfloat;
+}
+
+template <class Trie>
+void bench(std::string const& name, std::vector<int> const& keys, std::vector<int> const& counts)
+{
+    std::cout << "testing [" << name << ", " << keys.size() << " keys]\n";
+    for (auto threads : counts) {
+        Trie t;
+        measure("insert", keys, threads, [&](int key) { t.insert(key, key); });
+        measure("remove", keys, threads, [&](int key) { t.remove(key); });
+    }
+    std::cout << std::string(80, '=') << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    auto n = argc > 1 ? std::atoi(argv[1]) : 1'000'000;
+    auto max_threads = argc > 2 ? std::atoi(argv[2]) : 16;
+    auto counts = util::thread_counts(max_threads);
+
+    util::fast_random gen{1};
+    std::vector<int> keys(n);
+    for (auto key = 0; key < n; key++)
+        keys[key] = key;
+    for (auto i = n - 1; i > 0; i--)
+        std::swap(keys[i], keys[gen() % (i + 1)]);
+
+    using concurrent::epoch, concurrent::hazard, concurrent::no_backoff, concurrent::node_pool;
+    bench<concurrent::trie<int, int>>("epoch", keys, counts);
+    bench<concurrent::trie<int, int, util::hash<int>, hazard>>("hazard", keys, counts);
+    bench<concurrent::trie<int, int, util::hash<int>, epoch, no_backoff, node_pool>>(
+        "epoch, node pool", keys, counts);
+    bench<concurrent::trie<int, int, util::hash<int>, hazard, no_backoff, node_pool>>(
+        "hazard, node pool", keys, counts);
+}
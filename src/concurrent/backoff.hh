@@ -0,0 +1,82 @@
+#pragma once
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace concurrent
+{
+
+// tells the core it is spinning, so that it stops speculating on the line
+// it waits for and leaves the pipeline to a sibling hyperthread.
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// what an operation does between a failed CAS and its retry. one object
+// lives for one operation of the trie, failed is called whenever the
+// operation goes round again at the same slot, because its own CAS failed
+// or because it helped the update of another thread.
+
+// retry right away
+struct no_backoff
+{
+    void failed() {}
+};
+
+// pause for twice as long after every failure of the same operation
+template <int MaxSpins = 1024>
+struct exponential_backoff
+{
+    void failed()
+    {
+        for (auto i = 0; i < spins; i++)
+            cpu_relax();
+        spins = std::min(spins * 2, MaxSpins);
+    }
+
+    int spins{1};
+};
+
+// like exponential_backoff, but the first pause follows how many of the
+// recent operations of this thread had to retry, so that uncontended retries
+// cost nothing and a thread on a hot key starts out waiting. the rate is a
+// moving average over about 16 operations, in 1/65536.
+template <int MaxSpins = 1024>
+struct adaptive_backoff
+{
+    adaptive_backoff() = default;
+    adaptive_backoff(adaptive_backoff const&) = delete;
+    adaptive_backoff& operator=(adaptive_backoff const&) = delete;
+
+    ~adaptive_backoff()
+    {
+        auto& r = rate();
+        r = r - (r >> 4) + (failures ? (1u << 16) >> 4 : 0);
+    }
+
+    void failed()
+    {
+        if (!failures++)
+            spins = std::max(1, static_cast<int>((rate() * MaxSpins) >> 17));
+        for (auto i = 0; i < spins; i++)
+            cpu_relax();
+        spins = std::min(spins * 2, MaxSpins);
+    }
+
+    static auto rate() -> unsigned&
+    {
+        thread_local unsigned r = 0;
+        return r;
+    }
+
+    int failures{0};
+    int spins{1};
+};
+
+} // namespace concurrent
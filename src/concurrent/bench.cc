@@ -0,0 +1,100 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include "../util/timer.hh"
+#include "../util/perf.hh"
+#include "trie.hh"
+
+using trie_type = concurrent::trie<int, int>;
+
+// number of anodes visited from root before reaching the snode of hash
+auto depth(trie_type const& t, trie_type::hash_type hash)
+{
+    auto level = 0;
+    auto cur = t.root.load();
+    while (true) {
+        auto pos = (hash >> level) & (cur->values.size() - 1);
+        auto u = cur->values[pos].load();
+        if (u.type() != concurrent::node::anode)
+            return level / 4 + 1;
+        cur = concurrent::node_cast<trie_type::anode>(u);
+        level += 4;
+    }
+}
+
+// f over every key, for lookups and removes
+template <class F>
+auto bench_keys(std::vector<int> const& keys, std::string const& name, F f)
+{
+    util::timer t;
+    util::perf_counters counters;
+    auto found = 0;
+    counters.start();
+    t.start();
+    for (auto k : keys)
+        found += static_cast<bool>(f(k));
+    t.stop();
+    counters.stop();
+    std::cout << name << ": " << t.elapsed_milliseconds() << "ms, "
+        << t.elapsed_milliseconds() * 1e6 / keys.size() << "ns/op, "
+        << "found " << found << "\n    ";
+    counters.print(std::cout, keys.size());
+}
+
+int main()
+{
+    auto constexpr size = 4'000'000;
+
+    std::vector<int> keys(size);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937{42});
+
+    trie_type t;
+    util::timer insert_timer;
+    util::perf_counters insert_counters;
+    insert_counters.start();
+    insert_timer.start();
+    for (auto k : keys)
+        t.debug_insert(k);
+    insert_timer.stop();
+    insert_counters.stop();
+    std::shuffle(keys.begin(), keys.end(), std::mt19937{7});
+
+    // warm up the cache
+    for (auto k : keys)
+        t.debug_lookup(k);
+
+    auto c = t.cache.load();
+    auto cache_level = c ? c->level : 0;
+    double hops = 0;
+    for (auto k : keys)
+        hops += depth(t, t.hash(k));
+    hops /= size;
+
+    std::cout << "testing [cache trie lookup, " << size << " keys]\n";
+    std::cout << "sizeof snode: " << sizeof(trie_type::snode)
+        << ", anode: " << sizeof(trie_type::anode)
+        << ", enode: " << sizeof(trie_type::enode) << "\n";
+    std::cout << "insert: " << insert_timer.elapsed_milliseconds() << "ms, "
+        << insert_timer.elapsed_milliseconds() * 1e6 / size << "ns/op\n    ";
+    insert_counters.print(std::cout, size);
+    std::cout << "cache level: " << cache_level << "\n";
+    std::cout << "avg anodes from root: " << hops << "\n";
+    std::cout << "avg anodes from cache: " << hops - cache_level / 4 << "\n";
+
+    bench_keys(keys, "root walk", [&](int k) {
+        concurrent::epoch::guard g;
+        return t.lookup(k, t.hash(k), 0, t.root.load(), nullptr);
+    });
+    bench_keys(keys, "cached", [&](int k) {
+        return t.lookup(k);
+    });
+    std::shuffle(keys.begin(), keys.end(), std::mt19937{11});
+    bench_keys(keys, "remove", [&](int k) {
+        return t.remove(k);
+    });
+    std::cout << std::string(80, '=') << "\n";
+}
@@ -0,0 +1,87 @@
+// ml:ccf += -pthread
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <utility>
+#include <algorithm>
+#include <cstdlib>
+#include "../util/timer.hh"
+#include "../util/bulk.hh"
+#include "../util/throughput.hh"
+#include "../sequential/raw-pointer-trie.hh"
+#include "trie.hh"
+
+// the time to fill a trie with n pairs at startup, by insert on as many
+// threads as bulk_load gets, each taking every threads-th pair, and by
+// bulk_load, for growing thread counts. the pairs are the keys 0..n-1 in a
+// random order.
+//
+// usage: bulk-bench [keys] [max threads]
+
+template <class Trie>
+auto by_insert(std::vector<std::pair<int, int>> const& items, int threads) -> double
+{
+    Trie t;
+    util::timer timer;
+    timer.start();
+    util::parallel(threads, [&](int id) {
+        for (auto i = static_cast<std::size_t>(id); i < items.size(); i += threads)
+            t.insert(items[i].first, items[i].second);
+    });
+    timer.stop();
+    return timer.elapsed_milliseconds();
+}
+
+template <class Trie>
+auto by_bulk_load(std::vector<std::pair<int, int>> const& items, int threads) -> double
+{
+    Trie t;
+    util::timer timer;
+    timer.start();
+    t.bulk_load(items, threads);
+    timer.stop();
+    return timer.elapsed_milliseconds();
+}
+
+// sequential tries only take inserts from one thread
+template <class Trie>
+void bench(std::string const& name, std::vector<std::pair<int, int>> const& items,
+    std::vector<int> const& counts, bool concurrent)
+{
+    std::cout << "testing [" << name << ", " << items.size() << " keys]\n";
+    double first = 0;
+    for (auto threads : counts) {
+        auto insert = concurrent || threads == 1 ? by_insert<Trie>(items, threads) : 0;
+        auto bulk = by_bulk_load<Trie>(items, threads);
+        if (threads == 1)
+            first = bulk;
+        std::cout << std::setw(4) << threads << " threads: " << std::fixed << std::setprecision(1);
+        if (insert)
+            std::cout << "insert " << insert << " ms, ";
+        std::cout << "bulk_load " << bulk << " ms, speedup " << std::setprecision(2)
+            << first / bulk << "\n" << std::defaultfloat;
+    }
+    std::cout << std::string(80, '=') << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    auto keys = argc > 1 ? std::atoi(argv[1]) : 10'000'000;
+    auto max_threads = argc > 2 ? std::atoi(argv[2]) : util::hardware_threads();
+    auto counts = util::thread_counts(max_threads);
+
+    std::vector<std::pair<int, int>> items(keys);
+    for (auto key = 0; key < keys; key++)
+        items[key] = {key, key};
+    util::fast_random gen{1};
+    for (auto i = keys - 1; i > 0; i--)
+        std::swap(items[i], items[gen() % (i + 1)]);
+
+    using concurrent::epoch;
+    using concurrent::hazard;
+    bench<concurrent::trie<int, int, util::hash<int>, epoch>>("cache trie, epoch", items, counts, true);
+    bench<concurrent::trie<int, int, util::hash<int>, hazard>>("cache trie, hazard", items, counts, true);
+    bench<sequential::raw_trie<int, int>>("raw trie", items, counts, false);
+}
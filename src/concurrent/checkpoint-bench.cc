@@ -0,0 +1,99 @@
+// ml:ccf += -pthread
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <filesystem>
+#include <cstdlib>
+#include "../util/timer.hh"
+#include "../util/throughput.hh"
+#include "checkpoint.hh"
+#include "trie.hh"
+
+// what a checkpoint costs the operations running alongside it: a trie of
+// about prefill * key range keys is checkpointed alone first, for the write
+// throughput, then the throughput workload runs without a checkpoint and
+// with checkpoints written back to back, unthrottled and at fixed rates.
+// latency is sampled every 16 operations, for the p99 of every kind.
+//
+// usage: checkpoint-bench [threads] [duration ms] [file] [direct]
+
+using trie_type = concurrent::trie<int, int>;
+
+struct written
+{
+    int checkpoints{0};
+    double bytes{0};
+    double seconds{0};
+};
+
+auto write(trie_type& t, std::string const& path, util::image::options const& o,
+    std::ostream* progress = nullptr) -> written
+{
+    util::timer timer;
+    timer.start();
+    concurrent::checkpoint<trie_type> c{t, path, o, progress};
+    if (!c.wait())
+        std::cout << "    could not write " << path << "\n";
+    timer.stop();
+    return {1, static_cast<double>(c.bytes()), timer.elapsed_seconds()};
+}
+
+void report(written const& w)
+{
+    auto precision = std::cout.precision();
+    std::cout << "    " << w.checkpoints << " checkpoints, " << std::fixed << std::setprecision(2)
+        << w.bytes / w.checkpoints / (1 << 20) << " MB each, "
+        << w.bytes / (1 << 20) / w.seconds << " MB/s\n" << std::defaultfloat
+        << std::setprecision(static_cast<int>(precision));
+}
+
+int main(int argc, char** argv)
+{
+    auto threads = argc > 1 ? std::atoi(argv[1]) : util::hardware_threads();
+    util::workload w;
+    w.key_range = 1 << 22;
+    w.latency = 16;
+    if (argc > 2)
+        w.duration = std::chrono::milliseconds{std::atoi(argv[2])};
+    auto path = argc > 3 ? std::string{argv[3]}
+        : (std::filesystem::temp_directory_path() / "checkpoint-bench.img").string();
+    auto direct = argc > 4 && std::string{argv[4]} == "direct";
+
+    trie_type t;
+    util::prefill(t, w);
+    std::cout << "testing [checkpoint, " << w.key_range << " key range, " << threads
+        << " threads" << (direct ? ", O_DIRECT" : "") << "]\n";
+    std::cout << "  alone\n";
+    auto alone = write(t, path, {0, direct}, &std::cout);
+    std::cout << "\n";
+    report(alone);
+
+    std::cout << "  no checkpoint\n";
+    util::print(util::bench_throughput(t, threads, w));
+
+    for (auto rate : {0.0, 100.0, 25.0}) {
+        if (rate)
+            std::cout << "  checkpoints at " << rate << " MB/s\n";
+        else
+            std::cout << "  checkpoints unthrottled\n";
+        std::atomic<bool> stop{false};
+        written total;
+        std::thread writer([&] {
+            while (!stop.load()) {
+                auto one = write(t, path, {rate * (1 << 20), direct});
+                total.checkpoints += 1;
+                total.bytes += one.bytes;
+                total.seconds += one.seconds;
+            }
+        });
+        auto res = util::bench_throughput(t, threads, w);
+        stop = true;
+        writer.join();
+        util::print(res);
+        report(total);
+    }
+    std::filesystem::remove(path);
+    std::cout << std::string(80, '=') << "\n";
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include "../util/image.hh"
+#include "../util/progress-display.hh"
+
+namespace concurrent
+{
+
+// an image of a trie written on a thread of its own while the trie goes on
+// taking updates, see trie::stream for what ends up in it. the file is
+// written through one buffer of the writer, whatever the size of the trie,
+// at most at the rate of the options, and is read back by util::mapped_trie
+// or thawed into a trie. progress, if given, is where a util::progress_display
+// of the hash space done is shown. the trie has to outlive the checkpoint,
+// which waits for the file in its destructor.
+template <class Trie>
+struct checkpoint
+{
+    using key_type   = typename Trie::key_type;
+    using value_type = typename Trie::value_type;
+    using hash_type  = typename Trie::hash_type;
+    using writer     = util::image::writer<key_type, value_type, hash_type>;
+
+    checkpoint(Trie& t, std::string path, util::image::options const& o = {},
+        std::ostream* progress = nullptr)
+        : worker([this, &t, path = std::move(path), o, progress] { run(t, path, o, progress); })
+    {
+    }
+
+    checkpoint(checkpoint const&) = delete;
+    checkpoint& operator=(checkpoint const&) = delete;
+
+    ~checkpoint() { wait(); }
+
+    // true once the file is complete, false if it could not be written
+    auto wait() -> bool
+    {
+        if (worker.joinable())
+            worker.join();
+        return ok;
+    }
+
+    auto done() const -> bool { return finished.load(); }
+
+    // of the trie, from 0 to 1
+    auto progress() const -> double
+    {
+        return static_cast<double>(units.load(std::memory_order_relaxed)) / Trie::progress_units;
+    }
+
+    auto bytes() const -> std::uint64_t { return written.load(std::memory_order_relaxed); }
+
+    auto keys() const -> std::uint64_t { return count.load(std::memory_order_relaxed); }
+
+private:
+    void run(Trie& t, std::string const& path, util::image::options const& o, std::ostream* os)
+    {
+        writer w{path, o};
+        util::progress_display pd{Trie::progress_units};
+        auto root = t.stream(w, [&](std::size_t done) {
+            units.store(done, std::memory_order_relaxed);
+            written.store(w.bytes(), std::memory_order_relaxed);
+            count.store(w.count(), std::memory_order_relaxed);
+            if (os && done != pd.count) {
+                pd.tick(done - pd.count);
+                pd.display(*os);
+            }
+        });
+        ok = w.finish(root);
+        written.store(w.bytes(), std::memory_order_relaxed);
+        count.store(w.count(), std::memory_order_relaxed);
+        finished.store(true);
+    }
+
+    std::atomic<std::size_t> units{0};
+    std::atomic<std::uint64_t> written{0};
+    std::atomic<std::uint64_t> count{0};
+    std::atomic<bool> finished{false};
+    bool ok{false};
+    // last, it starts once the rest is there
+    std::thread worker;
+};
+
+} // namespace concurrent
@@ -0,0 +1,127 @@
+// ml:ccf += -pthread
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include "../util/throughput.hh"
+#include "../util/hash.hh"
+#include "trie.hh"
+
+// latency and stack use of the trie when all threads fight over a few keys,
+// so that most CAS fail and operations retry. deep puts every key below ten
+// anodes that hold nothing else, which is where a walk that recursed per
+// level, or restarted from root, paid the most.
+//
+// usage: contention-bench [threads] [duration ms]
+
+struct deep_hash
+{
+    auto operator()(int key) const -> std::uint64_t
+    {
+        return util::mix_hash{}(key) << 40;
+    }
+};
+
+// the stack an operation needs, measured by painting a region below the
+// caller and looking for the deepest byte that was overwritten. both
+// functions are called from the same frame, so their buffers coincide.
+// the generator adjust_cache_level seeds once per thread takes a
+// random_device, some 5kB of stack in libstdc++, so it is seeded first.
+auto constexpr stack_probe = std::size_t{32} << 10;
+auto constexpr stack_paint = std::uint8_t{0xa5};
+
+[[gnu::noinline]] void paint_stack()
+{
+    volatile std::uint8_t buf[stack_probe];
+    for (auto& b : buf)
+        b = stack_paint;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+[[gnu::noinline]] auto stack_used() -> std::size_t
+{
+    volatile std::uint8_t buf[stack_probe];
+    std::size_t i = 0;
+    while (i < stack_probe && buf[i] == stack_paint)
+        i++;
+    return stack_probe - i;
+}
+#pragma GCC diagnostic pop
+
+template <class Trie>
+auto max_stack(Trie& t, int threads, util::workload const& w) -> std::size_t
+{
+    std::atomic<bool> stop{false};
+    std::vector<std::size_t> used(threads);
+    std::vector<std::thread> workers;
+    for (auto id = 0; id < threads; id++)
+        workers.emplace_back([&, id] {
+            util::pin_thread(id);
+            util::fast_random gen{static_cast<std::uint64_t>(id) + 1};
+            {
+                typename Trie::guard g;
+                t.adjust_cache_level();
+            }
+            paint_stack();
+            while (!stop.load(std::memory_order_relaxed)) {
+                auto r = gen();
+                auto key = static_cast<int>((r >> 32) % w.key_range);
+                if (r % 2)
+                    t.insert(key, key);
+                else
+                    t.remove(key);
+            }
+            used[id] = stack_used();
+        });
+    std::this_thread::sleep_for(w.duration);
+    stop = true;
+    for (auto& th : workers)
+        th.join();
+    return *std::max_element(used.begin(), used.end());
+}
+
+template <class Trie>
+void bench(std::string const& name, int threads, util::workload w)
+{
+    for (auto hot : {16, 256, 65536}) {
+        w.key_range = hot;
+        std::cout << "testing [" << name << ", " << threads << " threads, "
+            << w.insert << "% insert " << w.remove << "% remove, " << hot << " keys]\n";
+        {
+            Trie t;
+            util::prefill(t, w);
+            util::print(util::bench_throughput(t, threads, w));
+        }
+        Trie t;
+        util::prefill(t, w);
+        std::cout << "    stack: " << max_stack(t, threads, w) << " bytes\n";
+    }
+    std::cout << std::string(80, '=') << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    auto hardware = static_cast<int>(std::thread::hardware_concurrency());
+    auto threads = argc > 1 ? std::atoi(argv[1]) : std::max(4, hardware);
+
+    util::workload w;
+    w.lookup = 0;
+    w.insert = 50;
+    w.remove = 50;
+    w.latency = 16;
+    if (argc > 2)
+        w.duration = std::chrono::milliseconds{std::atoi(argv[2])};
+
+    using concurrent::epoch;
+    using concurrent::hazard;
+    bench<concurrent::trie<int, int, util::hash<int>, epoch>>("cache trie, epoch", threads, w);
+    bench<concurrent::trie<int, int, util::hash<int>, hazard>>("cache trie, hazard", threads, w);
+    bench<concurrent::trie<int, int, deep_hash, epoch>>("cache trie, epoch, deep", threads, w);
+    bench<concurrent::trie<int, int, deep_hash, hazard>>("cache trie, hazard, deep", threads, w);
+}
@@ -0,0 +1,150 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <cstdint>
+#include <cstdlib>
+#include "../util/timer.hh"
+#include "../util/hash.hh"
+#include "trie.hh"
+
+// distribution of the depth of keys, in anodes from root, for 32 and 64 bit
+// hashes. a key sits one level below the longest run of low nibbles its hash
+// shares with any other hash, so the depths of a trie follow from its hashes
+// alone: sorted with the lowest nibble first, that run is shared with one of
+// the neighbours. this needs 8 bytes per key where the trie needs about 50,
+// and is checked against a real trie at a size that fits in memory.
+//
+// usage: depth-bench [keys] [trie keys]
+
+using hash64 = util::mix_hash;
+using hash32 = util::truncate_hash<util::mix_hash>;
+
+template <class H>
+auto nibble_reverse(H h) -> H
+{
+    H r = 0;
+    for (auto i = 0; i < std::numeric_limits<H>::digits; i += 4) {
+        r = (r << 4) | (h & 0xf);
+        h >>= 4;
+    }
+    return r;
+}
+
+template <class H>
+auto common_nibbles(H a, H b) -> int
+{
+    return __builtin_ctzll(a ^ b) / 4;
+}
+
+struct histogram
+{
+    void add(int depth, std::size_t n = 1)
+    {
+        if (depth >= static_cast<int>(counts.size()))
+            counts.resize(depth + 1);
+        counts[depth] += n;
+    }
+
+    void print(std::string const& name) const
+    {
+        auto total = std::accumulate(counts.begin(), counts.end(), std::size_t{0});
+        double avg = 0;
+        for (auto d = 0u; d < counts.size(); d++)
+            avg += static_cast<double>(d) * counts[d] / total;
+        std::cout << name << ": avg " << std::fixed << std::setprecision(3) << avg
+            << ", keys in lnodes " << lnode_keys << "\n   ";
+        for (auto d = 1u; d < counts.size(); d++)
+            std::cout << " " << d << ":" << std::setprecision(4)
+                << 100.0 * counts[d] / total << "%";
+        std::cout << "\n" << std::defaultfloat;
+    }
+
+    std::vector<std::size_t> counts;
+    std::size_t lnode_keys{0};
+};
+
+// the model, keys 0..n-1
+template <class Hash>
+auto model(std::size_t n) -> histogram
+{
+    using hash_type = util::hash_result_t<Hash, std::uint64_t>;
+    auto constexpr levels = std::numeric_limits<hash_type>::digits / 4;
+    Hash hash;
+    std::vector<hash_type> hs(n);
+    for (std::size_t k = 0; k < n; k++)
+        hs[k] = nibble_reverse(hash(k));
+    std::sort(hs.begin(), hs.end());
+
+    histogram hist;
+    for (std::size_t i = 0; i < n;) {
+        // keys of equal hashes share an lnode
+        auto j = i;
+        while (j < n && hs[j] == hs[i])
+            j++;
+        if (j - i > 1)
+            hist.lnode_keys += j - i;
+        auto h = nibble_reverse(hs[i]);
+        auto c = 0;
+        if (i > 0)
+            c = std::max(c, common_nibbles(h, nibble_reverse(hs[i - 1])));
+        if (j < n)
+            c = std::max(c, common_nibbles(h, nibble_reverse(hs[j])));
+        hist.add(std::min(c + 1, levels), j - i);
+        i = j;
+    }
+    return hist;
+}
+
+// the same measured on a trie, keys 0..n-1
+template <class Hash>
+auto measure(std::size_t n) -> histogram
+{
+    using trie_type = concurrent::trie<std::uint64_t, int, Hash>;
+    trie_type t;
+    for (std::size_t k = 0; k < n; k++)
+        t.insert(k, 0);
+
+    histogram hist;
+    for (std::size_t k = 0; k < n; k++) {
+        auto hash = t.hash(k);
+        auto level = 0;
+        auto cur = t.root.load();
+        while (true) {
+            auto pos = (hash >> level) & (cur->values.size() - 1);
+            auto u = cur->values[pos].load();
+            if (u.type() != concurrent::node::anode) {
+                hist.lnode_keys += u.type() == concurrent::node::lnode;
+                break;
+            }
+            cur = concurrent::node_cast<typename trie_type::anode>(u);
+            level += 4;
+        }
+        hist.add(level / 4 + 1);
+    }
+    return hist;
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t keys = argc > 1 ? std::atoll(argv[1]) : 100'000'000;
+    std::size_t trie_keys = argc > 2 ? std::atoll(argv[2]) : 4'000'000;
+
+    std::cout << "testing [trie depth, " << trie_keys << " keys in a trie]\n";
+    measure<hash32>(trie_keys).print("32 bit, trie ");
+    model<hash32>(trie_keys).print("32 bit, model");
+    measure<hash64>(trie_keys).print("64 bit, trie ");
+    model<hash64>(trie_keys).print("64 bit, model");
+
+    std::cout << "testing [trie depth, " << keys << " keys]\n";
+    util::timer t;
+    t.start();
+    model<hash32>(keys).print("32 bit");
+    model<hash64>(keys).print("64 bit");
+    t.stop();
+    std::cout << "model time " << t.elapsed_seconds() << "s\n";
+    std::cout << std::string(80, '=') << "\n";
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+
+namespace concurrent
+{
+
+// a CAS of two adjacent words at once, cmpxchg16b. on x86-64 a locked
+// instruction is atomic against any other on the same line, whatever its
+// size, so one of the two words may still be a std::atomic that other
+// threads CAS on its own. elsewhere there is none, see supported.
+namespace double_word
+{
+
+// may alias whatever the two words hold
+using word = std::uint64_t __attribute__((may_alias));
+
+struct alignas(16) pair
+{
+    word lo;
+    word hi;
+};
+
+#if defined(__x86_64__)
+
+inline constexpr bool supported = true;
+
+// replaces the 16 aligned bytes at p by desired if they equal expected,
+// otherwise loads them into expected
+inline auto compare_exchange(pair* p, pair& expected, pair const& desired) -> bool
+{
+    bool ok;
+    asm volatile("lock cmpxchg16b %1"
+        : "=@ccz"(ok), "+m"(*p), "+a"(expected.lo), "+d"(expected.hi)
+        : "b"(desired.lo), "c"(desired.hi)
+        : "memory");
+    return ok;
+}
+
+#else
+
+inline constexpr bool supported = false;
+
+inline auto compare_exchange(pair*, pair&, pair const&) -> bool
+{
+    return false;
+}
+
+#endif
+
+inline auto load(word const* p) -> std::uint64_t
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+} // namespace double_word
+
+} // namespace concurrent
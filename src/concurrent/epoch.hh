@@ -0,0 +1,144 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include "registry.hh"
+
+namespace concurrent
+{
+
+// epoch based reclamation. a thread holds a guard for the duration of an
+// operation, nodes unlinked from the structure are retired into the
+// thread's retire list stamped with the global epoch, and freed once the
+// global epoch has moved two steps past the stamp, at which point no guard
+// that could have seen them is still alive.
+struct epoch
+{
+    using epoch_type = std::uint64_t;
+    using deleter_type = void (*)(void*);
+
+    struct retired
+    {
+        void* ptr;
+        deleter_type deleter;
+        epoch_type stamp;
+    };
+
+    // state holds the local epoch shifted left by one, the lowest bit is set
+    // while the thread is inside a guard.
+    struct alignas(64) record
+    {
+        std::atomic<epoch_type> state{0};
+        std::atomic<bool> in_use{true};
+        std::atomic<std::size_t> pending{0};
+        int nesting{0};
+        int retire_count{0};
+        bool in_collect{false};
+        std::vector<retired> retired_list;
+        std::vector<retired> collecting;
+        record* next{nullptr};
+
+        void exit() { collect(*this); }
+    };
+
+    using records = registry<record>;
+
+    static constexpr int collect_threshold = 64;
+
+    inline static std::atomic<epoch_type> global{0};
+
+    struct guard
+    {
+        guard() : rec(records::local())
+        {
+            if (rec.nesting++ == 0)
+                rec.state.store((global.load() << 1) | 1);
+        }
+
+        ~guard()
+        {
+            if (--rec.nesting == 0)
+                rec.state.store(rec.state.load(std::memory_order_relaxed) & ~epoch_type{1},
+                    std::memory_order_release);
+        }
+
+        guard(guard const&) = delete;
+        guard& operator=(guard const&) = delete;
+
+        record& rec;
+    };
+
+    // the guard already protects everything reachable, so a hazard pointer
+    // is a plain load.
+    struct hazard_pointer
+    {
+        template <class V>
+        auto protect(std::atomic<V> const& src) const -> V { return src.load(); }
+
+        template <class U>
+        void set(U*) const {}
+    };
+
+    // the global epoch only moves when every thread inside a guard has
+    // observed the current one.
+    static auto try_advance() -> epoch_type
+    {
+        auto g = global.load();
+        for (auto r = records::records.load(); r; r = r->next) {
+            auto s = r->state.load();
+            if ((s & 1) && (s >> 1) != g)
+                return g;
+        }
+        global.compare_exchange_strong(g, g + 1);
+        return global.load();
+    }
+
+    // deleters may retire further nodes, so the list is swapped out first.
+    static void collect(record& rec)
+    {
+        if (rec.in_collect)
+            return;
+        rec.in_collect = true;
+        auto g = try_advance();
+        std::swap(rec.retired_list, rec.collecting);
+        for (auto const& r : rec.collecting) {
+            if (r.stamp + 2 <= g)
+                r.deleter(r.ptr);
+            else
+                rec.retired_list.push_back(r);
+        }
+        rec.collecting.clear();
+        rec.pending.store(rec.retired_list.size(), std::memory_order_relaxed);
+        rec.in_collect = false;
+    }
+
+    static void retire(void* p, deleter_type deleter)
+    {
+        auto& rec = records::local();
+        rec.retired_list.push_back({p, deleter, global.load()});
+        rec.pending.store(rec.retired_list.size(), std::memory_order_relaxed);
+        if (++rec.retire_count >= collect_threshold) {
+            rec.retire_count = 0;
+            collect(rec);
+        }
+    }
+
+    template <class T>
+    static void retire(T* p)
+    {
+        retire(p, [](void* u) { delete static_cast<T*>(u); });
+    }
+
+    // nodes retired but not yet freed over all threads, racy
+    static auto retired_count() -> std::size_t
+    {
+        std::size_t n = 0;
+        for (auto r = records::records.load(); r; r = r->next)
+            n += r->pending.load(std::memory_order_relaxed);
+        return n;
+    }
+};
+
+} // namespace concurrent
@@ -0,0 +1,110 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <functional>
+#include "../util/timer.hh"
+#include "../util/hash.hh"
+#include "trie.hh"
+
+// depth and throughput of the trie for each hasher. the depth is the number
+// of anodes from root to the leaf of a key. sequential keys spread evenly
+// under the identity, strided keys, like ids with a shard in their low bits
+// or addresses, leave the low levels of the trie unused.
+
+auto constexpr size = 1'000'000;
+
+struct std_hash
+{
+    auto operator()(std::string const& s) const -> std::uint64_t
+    {
+        return std::hash<std::string>{}(s);
+    }
+};
+
+template <class Trie>
+auto depth(Trie const& t, typename Trie::hash_type hash)
+{
+    auto level = 0;
+    auto cur = t.root.load();
+    while (true) {
+        auto pos = (hash >> level) & (cur->values.size() - 1);
+        auto u = cur->values[pos].load();
+        if (u.type() != concurrent::node::anode)
+            return level / 4 + 1;
+        cur = concurrent::node_cast<typename Trie::anode>(u);
+        level += 4;
+    }
+}
+
+template <class Key, class Hash>
+void bench(std::string const& name, std::vector<Key> keys)
+{
+    using trie_type = concurrent::trie<Key, int, Hash>;
+    trie_type t;
+
+    util::timer insert_timer;
+    insert_timer.start();
+    for (auto const& k : keys)
+        t.insert(k, 0);
+    insert_timer.stop();
+
+    std::shuffle(keys.begin(), keys.end(), std::mt19937{7});
+    // warm up the cache
+    for (auto const& k : keys)
+        t.lookup(k);
+    util::timer lookup_timer;
+    auto found = 0;
+    lookup_timer.start();
+    for (auto const& k : keys)
+        found += static_cast<bool>(t.lookup(k));
+    lookup_timer.stop();
+
+    double avg = 0;
+    auto max = 0;
+    for (auto const& k : keys) {
+        auto d = depth(t, t.hash(k));
+        avg += d;
+        max = std::max(max, d);
+    }
+    avg /= keys.size();
+
+    std::cout << name << ": insert "
+        << insert_timer.elapsed_milliseconds() * 1e6 / keys.size() << "ns/op, lookup "
+        << lookup_timer.elapsed_milliseconds() * 1e6 / keys.size() << "ns/op, depth avg "
+        << avg << " max " << max << ", found " << found << "\n";
+}
+
+template <class Hash>
+void bench_int(std::string const& name)
+{
+    std::vector<int> sequential(size);
+    std::iota(sequential.begin(), sequential.end(), 0);
+    auto strided = sequential;
+    for (auto& k : strided)
+        k <<= 10;
+    std::vector<int> random(size);
+    std::mt19937 gen{42};
+    std::generate(random.begin(), random.end(), [&] { return static_cast<int>(gen()); });
+
+    bench<int, Hash>(name + ", sequential", sequential);
+    bench<int, Hash>(name + ", strided", strided);
+    bench<int, Hash>(name + ", random", random);
+}
+
+int main()
+{
+    std::cout << "testing [hashers, " << size << " keys]\n";
+    bench_int<util::identity_hash>("identity");
+    bench_int<util::fold_hash>("fold");
+    bench_int<util::mix_hash>("mix");
+
+    std::vector<std::string> keys(size);
+    for (auto i = 0; i < size; i++)
+        keys[i] = "user:" + std::to_string(i);
+    bench<std::string, std_hash>("std::hash, strings", keys);
+    bench<std::string, util::string_hash>("wyhash, strings", keys);
+    std::cout << std::string(80, '=') << "\n";
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include "registry.hh"
+
+namespace concurrent
+{
+
+// hazard pointer reclamation. before touching a node a thread publishes it in
+// one of its hazard slots and checks that the node is still reachable from
+// where it was read, retired nodes are only freed once no slot holds them.
+// unlike epochs, a stalled thread pins only the nodes it has published, so
+// every thread keeps at most a fixed number of retired nodes around.
+//
+// hazard pointers are taken from a per-thread stack of slots and must be
+// released in reverse order, which automatic variables do by construction.
+struct hazard
+{
+    using deleter_type = void (*)(void*);
+
+    struct retired
+    {
+        void* ptr;
+        deleter_type deleter;
+    };
+
+    static constexpr int slots = 128;
+
+    struct alignas(64) record
+    {
+        std::atomic<void*> hazards[slots]{};
+        std::atomic<bool> in_use{true};
+        std::atomic<std::size_t> pending{0};
+        int top{0};
+        bool in_scan{false};
+        std::vector<retired> retired_list;
+        std::vector<retired> scanning;
+        std::vector<void*> protected_list;
+        record* next{nullptr};
+
+        void exit() { scan(*this); }
+    };
+
+    using records = registry<record>;
+
+    // nothing is protected by merely being inside an operation
+    struct guard
+    {
+        guard() : rec(records::local()) {}
+
+        guard(guard const&) = delete;
+        guard& operator=(guard const&) = delete;
+
+        record& rec;
+    };
+
+    // what a value read from a slot points to, tagged pointers know their
+    // own address.
+    template <class U>
+    static auto address(U* p) -> void* { return p; }
+
+    template <class V>
+    static auto address(V const& v) -> decltype(v.address()) { return v.address(); }
+
+    struct hazard_pointer
+    {
+        hazard_pointer() : rec(records::local()), index(rec.top++)
+        {
+            assert(index < slots);
+        }
+
+        ~hazard_pointer()
+        {
+            rec.hazards[index].store(nullptr, std::memory_order_release);
+            rec.top--;
+        }
+
+        hazard_pointer(hazard_pointer const&) = delete;
+        hazard_pointer& operator=(hazard_pointer const&) = delete;
+
+        // publishing and reloading until both agree guarantees the node had
+        // not been unlinked, and so not retired, when it became protected.
+        template <class V>
+        auto protect(std::atomic<V> const& src) -> V
+        {
+            auto p = src.load();
+            while (true) {
+                rec.hazards[index].store(address(p));
+                auto q = src.load();
+                if (q == p)
+                    return p;
+                p = q;
+            }
+        }
+
+        // for nodes whose retirement waits on a node that is already
+        // protected.
+        template <class U>
+        void set(U* p)
+        {
+            rec.hazards[index].store(p);
+        }
+
+        record& rec;
+        int index;
+    };
+
+    // twice the slots in use keeps the cost of a scan constant per retire
+    static auto scan_threshold() -> std::size_t
+    {
+        return 2 * slots * static_cast<std::size_t>(records::count.load());
+    }
+
+    // deleters may retire further nodes, so the list is swapped out first.
+    static void scan(record& rec)
+    {
+        if (rec.in_scan)
+            return;
+        rec.in_scan = true;
+        auto& hp = rec.protected_list;
+        hp.clear();
+        for (auto r = records::records.load(); r; r = r->next)
+            for (auto const& h : r->hazards)
+                if (auto p = h.load())
+                    hp.push_back(p);
+        std::sort(hp.begin(), hp.end());
+        std::swap(rec.retired_list, rec.scanning);
+        for (auto const& r : rec.scanning) {
+            if (std::binary_search(hp.begin(), hp.end(), r.ptr))
+                rec.retired_list.push_back(r);
+            else
+                r.deleter(r.ptr);
+        }
+        rec.scanning.clear();
+        rec.pending.store(rec.retired_list.size(), std::memory_order_relaxed);
+        rec.in_scan = false;
+    }
+
+    static void retire(void* p, deleter_type deleter)
+    {
+        auto& rec = records::local();
+        rec.retired_list.push_back({p, deleter});
+        rec.pending.store(rec.retired_list.size(), std::memory_order_relaxed);
+        if (rec.retired_list.size() >= scan_threshold())
+            scan(rec);
+    }
+
+    template <class T>
+    static void retire(T* p)
+    {
+        retire(p, [](void* u) { delete static_cast<T*>(u); });
+    }
+
+    // nodes retired but not yet freed over all threads, racy
+    static auto retired_count() -> std::size_t
+    {
+        std::size_t n = 0;
+        for (auto r = records::records.load(); r; r = r->next)
+            n += r->pending.load(std::memory_order_relaxed);
+        return n;
+    }
+};
+
+} // namespace concurrent
@@ -0,0 +1,43 @@
+// ml:ccf += -pthread
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <cstdlib>
+#include "../util/throughput.hh"
+#include "../util/hash.hh"
+#include "backoff.hh"
+#include "trie.hh"
+
+// the backoff policies with all threads updating a handful of keys, so that
+// nearly every CAS races with another thread for the same slot or txn.
+//
+// usage: hotkey-bench [max threads] [duration ms]
+
+template <class Backoff>
+using trie_type = concurrent::trie<int, int, util::hash<int>, concurrent::epoch, Backoff>;
+
+int main(int argc, char** argv)
+{
+    auto hardware = static_cast<int>(std::thread::hardware_concurrency());
+    auto max_threads = argc > 1 ? std::atoi(argv[1]) : std::max(4, hardware);
+    auto counts = util::thread_counts(max_threads);
+
+    for (auto [insert, remove] : {std::pair{100, 0}, std::pair{50, 50}}) {
+        for (auto keys : {1, 4, 16}) {
+            util::workload w;
+            w.lookup = 0;
+            w.insert = insert;
+            w.remove = remove;
+            w.key_range = keys;
+            w.prefill = 1;
+            if (argc > 2)
+                w.duration = std::chrono::milliseconds{std::atoi(argv[2])};
+            util::bench_scaling<trie_type<concurrent::no_backoff>>(
+                "cache trie, no backoff", w, counts);
+            util::bench_scaling<trie_type<concurrent::exponential_backoff<>>>(
+                "cache trie, exponential backoff", w, counts);
+            util::bench_scaling<trie_type<concurrent::adaptive_backoff<>>>(
+                "cache trie, adaptive backoff", w, counts);
+        }
+    }
+}
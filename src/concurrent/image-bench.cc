@@ -0,0 +1,95 @@
+// ml:ccf += -pthread
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <utility>
+#include <filesystem>
+#include <cstdlib>
+#include "../util/timer.hh"
+#include "../util/throughput.hh"
+#include "../util/image.hh"
+#include "trie.hh"
+
+// a warm restart from an image against a rebuild: n keys are bulk loaded,
+// as from a dump, the trie is saved as an image, the image is mapped and
+// looked up in place, then thawed into a new trie. lookups take every key
+// once, in a random order.
+//
+// usage: image-bench [keys] [file] [threads]
+
+template <class F>
+auto measure(F&& fn) -> double
+{
+    util::timer t;
+    t.start();
+    fn();
+    t.stop();
+    return t.elapsed_milliseconds();
+}
+
+template <class Map>
+auto lookups(Map& m, std::vector<int> const& keys) -> double
+{
+    long found = 0;
+    auto ms = measure([&] {
+        for (auto key : keys)
+            found += m.lookup(key).has_value();
+    });
+    if (found != static_cast<long>(keys.size()))
+        std::cout << "    missing " << keys.size() - found << " keys\n";
+    return keys.size() / ms / 1e3;
+}
+
+int main(int argc, char** argv)
+{
+    auto n = argc > 1 ? std::atoi(argv[1]) : 4'000'000;
+    auto path = argc > 2 ? std::string{argv[2]}
+        : (std::filesystem::temp_directory_path() / "image-bench.img").string();
+    auto threads = argc > 3 ? std::atoi(argv[3]) : util::hardware_threads();
+
+    util::fast_random gen{1};
+    std::vector<std::pair<int, int>> items(n);
+    std::vector<int> keys(n);
+    for (auto i = 0; i < n; i++) {
+        items[i] = {static_cast<int>(gen()), i};
+        keys[i] = items[i].first;
+    }
+    for (auto i = n - 1; i > 0; i--)
+        std::swap(keys[i], keys[gen() % (i + 1)]);
+
+    std::cout << "testing [image, " << n << " keys, " << threads << " threads]\n" << std::fixed
+        << std::setprecision(2);
+    {
+        concurrent::trie<int, int> t;
+        std::cout << "    rebuild  " << measure([&] { t.bulk_load(items, threads); }) << " ms\n";
+        std::cout << "    lookup   " << lookups(t, keys) << " Mops/s\n";
+        auto saved = false;
+        auto ms = measure([&] { saved = t.save(path); });
+        if (!saved) {
+            std::cout << "    could not write " << path << "\n";
+            return 1;
+        }
+        auto mb = static_cast<double>(std::filesystem::file_size(path)) / (1 << 20);
+        std::cout << "    save     " << ms << " ms, " << mb << " MB, " << mb / ms * 1e3 << " MB/s\n";
+    }
+    {
+        util::mapped_trie<int, int>* m = nullptr;
+        std::cout << "    map      " << measure([&] { m = new util::mapped_trie<int, int>{path}; })
+            << " ms\n";
+        if (!*m) {
+            std::cout << "    " << m->error << "\n";
+            return 1;
+        }
+        std::cout << "    mapped   " << lookups(*m, keys) << " Mops/s, first touch\n";
+        std::cout << "    mapped   " << lookups(*m, keys) << " Mops/s\n";
+        concurrent::trie<int, int>* t = nullptr;
+        std::cout << "    thaw     " << measure([&] { t = new concurrent::trie<int, int>{*m, threads}; })
+            << " ms\n";
+        std::cout << "    thawed   " << lookups(*t, keys) << " Mops/s\n";
+        delete t;
+        delete m;
+    }
+    std::filesystem::remove(path);
+    std::cout << std::string(80, '=') << "\n" << std::defaultfloat;
+}
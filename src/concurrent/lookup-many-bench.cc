@@ -0,0 +1,89 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <optional>
+#include <utility>
+#include <cstdlib>
+#include "../util/timer.hh"
+#include "../util/perf.hh"
+#include "../util/throughput.hh"
+#include "../sequential/raw-pointer-trie.hh"
+#include "trie.hh"
+
+// lookups in batches, as a request handler does them, by a loop of lookup
+// and by lookup_many, on tries far larger than the last level cache. the
+// batches are random keys of twice the key range, so half of them miss.
+//
+// usage: lookup-many-bench [keys] [batch] [lookups]
+
+// a batch of the queries, in place
+struct slice
+{
+    auto begin() const { return first; }
+    auto end() const { return last; }
+
+    int const* first;
+    int const* last;
+};
+
+template <class Trie>
+void bench(std::string const& name, int keys, int batch, int lookups)
+{
+    std::cout << "testing [" << name << ", " << keys << " keys, batches of " << batch << "]\n";
+    Trie t;
+    {
+        std::vector<std::pair<int, int>> items(keys);
+        for (auto key = 0; key < keys; key++)
+            items[key] = {key, key};
+        t.bulk_load(items);
+    }
+    std::vector<int> queries(lookups);
+    util::fast_random gen{1};
+    for (auto& key : queries)
+        key = static_cast<int>(gen() % (2 * static_cast<std::uint64_t>(keys)));
+    std::vector<std::optional<int>> out(batch);
+
+    auto measure = [&](std::string const& how, auto run) {
+        util::timer timer;
+        util::perf_counters counters;
+        long found = 0;
+        counters.start();
+        timer.start();
+        for (auto i = 0; i + batch <= lookups; i += batch) {
+            run(slice{queries.data() + i, queries.data() + i + batch});
+            for (auto& v : out)
+                found += v.has_value();
+        }
+        timer.stop();
+        counters.stop();
+        auto done = static_cast<double>(lookups / batch * batch);
+        std::cout << "    " << std::left << std::setw(12) << how << std::right
+            << std::fixed << std::setprecision(2)
+            << timer.elapsed_seconds() * 1e9 / done << " ns/lookup, "
+            << found << " found\n" << std::defaultfloat;
+        std::cout << "    ";
+        counters.print(std::cout, done);
+    };
+    measure("lookup", [&](slice b) {
+        for (auto i = 0; i < batch; i++)
+            out[i] = t.lookup(b.first[i]);
+    });
+    measure("lookup_many", [&](slice b) {
+        t.lookup_many(b, out);
+    });
+    std::cout << std::string(80, '=') << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    auto keys = argc > 1 ? std::atoi(argv[1]) : 10'000'000;
+    auto batch = argc > 2 ? std::atoi(argv[2]) : 32;
+    auto lookups = argc > 3 ? std::atoi(argv[3]) : 4'000'000;
+
+    using concurrent::epoch;
+    using concurrent::hazard;
+    bench<concurrent::trie<int, int, util::hash<int>, epoch>>("cache trie, epoch", keys, batch, lookups);
+    bench<concurrent::trie<int, int, util::hash<int>, hazard>>("cache trie, hazard", keys, batch, lookups);
+    bench<sequential::raw_trie<int, int>>("raw trie", keys, batch, lookups);
+}
@@ -0,0 +1,203 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <cstddef>
+#include "registry.hh"
+
+namespace concurrent
+{
+
+// the allocators of the nodes of the trie, its Allocator. both hand out
+// blocks of size bytes aligned to granule, and take them back with the
+// size they were asked for.
+
+// every node from operator new, and back to operator delete as soon as it
+// is freed, so that what removals and the compression of sparse anodes let
+// go of goes back to the heap, and from there to the system. the default.
+struct heap_allocator
+{
+    static constexpr std::size_t granule = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+    static auto allocate(std::size_t size) -> void* { return ::operator new(size); }
+
+    static void deallocate(void* p, std::size_t size) { ::operator delete(p, size); }
+};
+
+// a thread caching allocator for the nodes of the trie. blocks come in size
+// classes of granule bytes up to max_size, larger ones are left to operator
+// new. every thread keeps a free list per class and allocates and frees on
+// it without synchronization. a list that grows to twice batch hands batch
+// blocks over to the central list of its class, an empty one takes a batch
+// from there, or carves one out of the chunk of the class. chunks are never
+// given back, what the trie frees stays with the pool for the nodes to
+// come, which makes it the faster allocator under churn, but leaves the
+// resident set at its peak after a mass removal. the free lists of an
+// exited thread go back to the central lists, and so does what it frees
+// after that.
+struct node_pool
+{
+    static constexpr std::size_t granule = 16;
+    static constexpr std::size_t max_size = 512;
+    static constexpr std::size_t classes = max_size / granule;
+    static constexpr int batch = 64;
+    static constexpr std::size_t chunk_size = 1 << 20;
+
+    struct block
+    {
+        block* next;
+        // the next batch of a central list, kept by the first block of a batch
+        block* next_batch;
+    };
+
+    struct alignas(64) central
+    {
+        std::mutex lock;
+        block* batches{nullptr};
+        char* chunk{nullptr};
+        char* chunk_end{nullptr};
+    };
+
+    struct record
+    {
+        std::atomic<bool> in_use{true};
+        record* next{nullptr};
+        block* free[classes]{};
+        int count[classes]{};
+
+        void exit()
+        {
+            for (auto c = 0u; c < classes; c++)
+                if (count[c])
+                    release(*this, c, count[c]);
+        }
+    };
+
+    using records = registry<record>;
+
+    // like registry::owner, but the record is cleared before it is given
+    // back. the exit of a reclamation scheme may free nodes after that.
+    struct owner
+    {
+        owner() : rec(records::acquire()) { current = rec; }
+
+        ~owner()
+        {
+            current = nullptr;
+            rec->exit();
+            rec->in_use.store(false);
+        }
+
+        record* rec;
+    };
+
+    inline static thread_local record* current{nullptr};
+
+    // null once the thread is exiting
+    static auto local() -> record*
+    {
+        thread_local owner o;
+        return current;
+    }
+
+    static auto centrals() -> central*
+    {
+        static central c[classes];
+        return c;
+    }
+
+    // bytes taken from operator new for chunks, over all classes
+    inline static std::atomic<std::size_t> reserved{0};
+
+    static auto size_class(std::size_t size) -> std::size_t
+    {
+        return (size + granule - 1) / granule - 1;
+    }
+
+    static auto allocate(std::size_t size) -> void*
+    {
+        if (size > max_size)
+            return ::operator new(size);
+        auto r = local();
+        if (!r)
+            return ::operator new(size);
+        auto c = size_class(size);
+        if (!r->free[c])
+            refill(*r, c);
+        auto b = r->free[c];
+        r->free[c] = b->next;
+        r->count[c] -= 1;
+        return b;
+    }
+
+    static void deallocate(void* p, std::size_t size)
+    {
+        if (size > max_size) {
+            ::operator delete(p);
+            return;
+        }
+        auto c = size_class(size);
+        auto b = static_cast<block*>(p);
+        auto r = local();
+        if (!r) {
+            b->next = nullptr;
+            auto& cl = centrals()[c];
+            std::lock_guard lock{cl.lock};
+            b->next_batch = cl.batches;
+            cl.batches = b;
+            return;
+        }
+        b->next = r->free[c];
+        r->free[c] = b;
+        if (++r->count[c] >= 2 * batch)
+            release(*r, c, batch);
+    }
+
+    // a batch from the central list of c, or a new one
+    static void refill(record& r, std::size_t c)
+    {
+        auto& cl = centrals()[c];
+        std::lock_guard lock{cl.lock};
+        if (auto b = cl.batches) {
+            cl.batches = b->next_batch;
+            auto n = 0;
+            for (auto u = b; u; u = u->next)
+                n += 1;
+            r.free[c] = b;
+            r.count[c] = n;
+            return;
+        }
+        auto size = (c + 1) * granule;
+        if (cl.chunk_end - cl.chunk < static_cast<std::ptrdiff_t>(batch * size)) {
+            cl.chunk = static_cast<char*>(::operator new(chunk_size));
+            cl.chunk_end = cl.chunk + chunk_size;
+            reserved.fetch_add(chunk_size, std::memory_order_relaxed);
+        }
+        block* head = nullptr;
+        for (auto i = 0; i < batch; i++) {
+            auto b = reinterpret_cast<block*>(cl.chunk_end -= size);
+            b->next = head;
+            head = b;
+        }
+        r.free[c] = head;
+        r.count[c] = batch;
+    }
+
+    // the first n blocks of the free list of c go to the central list
+    static void release(record& r, std::size_t c, int n)
+    {
+        auto head = r.free[c];
+        auto last = head;
+        for (auto i = 1; i < n; i++)
+            last = last->next;
+        r.free[c] = last->next;
+        r.count[c] -= n;
+        last->next = nullptr;
+        auto& cl = centrals()[c];
+        std::lock_guard lock{cl.lock};
+        head->next_batch = cl.batches;
+        cl.batches = head;
+    }
+};
+
+} // namespace concurrent
@@ -0,0 +1,90 @@
+// ml:ccf += -pthread
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <cstdlib>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "../util/timer.hh"
+#include "../util/memory.hh"
+#include "trie.hh"
+
+// the footprint of the trie before and after a mass deletion: n keys are
+// inserted, then all but one in keep removed, on threads threads. a trie
+// that compresses sparse anodes shrinks with its keys, one that only
+// empties slots keeps its peak, and so does one with nodes from node_pool.
+// the resident set is taken after the heap has given back what it can.
+//
+// usage: purge-bench [keys] [keep one in] [threads]
+
+template <class Trie>
+void report(std::string const& name, Trie const& t, std::size_t base)
+{
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    auto s = t.stats();
+    std::size_t anodes = 0;
+    for (auto const& k : s.kinds)
+        if (k.name == "anode-4" || k.name == "anode-16")
+            anodes += k.count;
+    std::cout << "    " << std::left << std::setw(10) << name << std::right << std::fixed
+        << std::setprecision(2) << s.keys << " keys, " << anodes << " anodes, "
+        << static_cast<double>(s.bytes) / (1 << 20) << " MB in nodes, "
+        << static_cast<double>(util::resident_bytes() - base) / (1 << 20) << " MB resident\n"
+        << std::defaultfloat;
+}
+
+template <class F>
+void parallel(int threads, int n, F&& fn)
+{
+    std::vector<std::thread> workers;
+    for (auto id = 0; id < threads; id++)
+        workers.emplace_back([&, id] {
+            for (auto key = id; key < n; key += threads)
+                fn(key);
+        });
+    for (auto& w : workers)
+        w.join();
+}
+
+template <class Trie>
+void bench(std::string const& name, int n, int keep, int threads, std::size_t base)
+{
+    std::cout << "testing [purge, " << name << ", " << n << " keys, one in " << keep << " kept, "
+        << threads << " threads]\n";
+    {
+        Trie t;
+        parallel(threads, n, [&](int key) { t.insert(key, key); });
+        report("loaded", t, base);
+        util::timer timer;
+        timer.start();
+        parallel(threads, n, [&](int key) {
+            if (key % keep)
+                t.remove(key);
+        });
+        timer.stop();
+        report("purged", t, base);
+        std::cout << "    removes: " << timer.elapsed_seconds() * 1e9 / n << " ns/op\n";
+        parallel(threads, n, [&](int key) { t.insert(key, key); });
+        report("refilled", t, base);
+    }
+    std::cout << std::string(80, '=') << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    auto n = argc > 1 ? std::atoi(argv[1]) : 4'000'000;
+    auto keep = argc > 2 ? std::atoi(argv[2]) : 100;
+    auto threads = argc > 3 ? std::atoi(argv[3]) : 4;
+    auto base = util::resident_bytes();
+
+    using concurrent::epoch, concurrent::no_backoff, concurrent::node_pool;
+    bench<concurrent::trie<int, int>>("heap", n, keep, threads, base);
+    // last, the pool keeps its blocks after the trie is gone
+    bench<concurrent::trie<int, int, util::hash<int>, epoch, no_backoff, node_pool>>(
+        "node pool", n, keep, threads, base);
+}
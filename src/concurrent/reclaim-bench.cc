@@ -0,0 +1,95 @@
+// ml:ccf += -pthread
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "../util/timer.hh"
+#include "trie.hh"
+
+// throughput and peak number of retired but not yet freed nodes for each
+// reclamation policy, under a mixed workload of 50% lookups, 25% inserts and
+// 25% removes. with a stalled reader one more thread enters an operation
+// and never leaves it, epochs stop advancing while hazard pointers only pin
+// what that thread has published.
+
+auto constexpr key_range = 1 << 20;
+auto constexpr duration  = std::chrono::seconds{2};
+
+template <class Reclaimer>
+void bench(std::string const& name, int threads, bool stalled)
+{
+    using trie_type = concurrent::trie<int, int, util::hash<int>, Reclaimer>;
+    trie_type t;
+    for (auto k = 0; k < key_range; k += 2)
+        t.debug_insert(k);
+
+    std::atomic<bool> stop{false};
+    std::atomic<long long> total{0};
+    std::vector<std::thread> workers;
+    for (auto id = 0; id < threads; id++)
+        workers.emplace_back([&, id] {
+            std::mt19937 gen{static_cast<unsigned>(id) + 1};
+            std::uniform_int_distribution<> dis_op(0, 3);
+            std::uniform_int_distribution<> dis_key(0, key_range - 1);
+            long long ops = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                auto op = dis_op(gen);
+                auto key = dis_key(gen);
+                if (op < 2)
+                    t.debug_lookup(key);
+                else if (op == 2)
+                    t.debug_insert(key);
+                else
+                    t.debug_remove(key);
+                ops++;
+            }
+            total += ops;
+        });
+
+    std::thread staller;
+    if (stalled)
+        staller = std::thread([&] {
+            typename Reclaimer::guard g;
+            typename Reclaimer::hazard_pointer hp;
+            hp.protect(t.root);
+            while (!stop.load())
+                std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        });
+
+    // left over by the previous run
+    auto base = Reclaimer::retired_count();
+    std::size_t peak = base;
+    util::timer timer;
+    timer.start();
+    auto end = std::chrono::steady_clock::now() + duration;
+    while (std::chrono::steady_clock::now() < end) {
+        peak = std::max(peak, Reclaimer::retired_count());
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    stop = true;
+    for (auto& w : workers)
+        w.join();
+    timer.stop();
+    if (stalled)
+        staller.join();
+
+    std::cout << name << (stalled ? " (stalled reader)" : "") << ": "
+        << total.load() / timer.elapsed_seconds() / 1e6 << " Mops/s, "
+        << "peak retired nodes " << peak - base << "\n";
+}
+
+int main()
+{
+    auto threads = static_cast<int>(std::max(4u, std::thread::hardware_concurrency()));
+    std::cout << "testing [reclamation, " << threads << " threads, "
+        << key_range << " keys]\n";
+    for (auto stalled : {false, true}) {
+        bench<concurrent::epoch>("epoch", threads, stalled);
+        bench<concurrent::hazard>("hazard", threads, stalled);
+    }
+    std::cout << std::string(80, '=') << "\n";
+}
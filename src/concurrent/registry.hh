@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+
+namespace concurrent
+{
+
+// the per-thread records of a reclamation scheme. records are never freed, a
+// record released by an exited thread is reused by the next thread together
+// with whatever it still has pending. Record needs an `in_use` flag, a `next`
+// pointer and an `exit()` hook that runs when its thread goes away.
+template <class Record>
+struct registry
+{
+    inline static std::atomic<Record*> records{nullptr};
+    inline static std::atomic<int> count{0};
+
+    static auto acquire() -> Record*
+    {
+        for (auto r = records.load(); r; r = r->next) {
+            auto expected = false;
+            if (!r->in_use.load() && r->in_use.compare_exchange_strong(expected, true))
+                return r;
+        }
+        auto r = new Record;
+        auto head = records.load();
+        do {
+            r->next = head;
+        } while (!records.compare_exchange_weak(head, r));
+        count.fetch_add(1);
+        return r;
+    }
+
+    struct owner
+    {
+        owner() : rec(acquire()) {}
+
+        ~owner()
+        {
+            rec->exit();
+            rec->in_use.store(false);
+        }
+
+        Record* rec;
+    };
+
+    static auto local() -> Record&
+    {
+        thread_local owner o;
+        return *o.rec;
+    }
+};
+
+} // namespace concurrent
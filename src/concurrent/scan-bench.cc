@@ -0,0 +1,144 @@
+// ml:ccf += -pthread
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include "../util/timer.hh"
+#include "../util/perf.hh"
+#include "../util/throughput.hh"
+#include "trie.hh"
+
+// full scans of a trie of keys 0..n-1: a lookup of every key for reference,
+// for_each, the iterator, for_each over a snapshot, and for_each while
+// writers insert and remove keys from n up, which the scan may or may not
+// see. the trie is filled by as many threads as there are cores, and takes
+// some 100 bytes a key, 5GB at the default size.
+//
+// usage: scan-bench [keys] [writers] [repeat]
+
+template <class Trie>
+void fill(Trie& t, int keys)
+{
+    auto threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> workers;
+    for (auto id = 0; id < threads; id++)
+        workers.emplace_back([&, id] {
+            for (auto key = id; key < keys; key += threads)
+                t.insert(key, key);
+        });
+    for (auto& th : workers)
+        th.join();
+}
+
+// the keys visited and their sum, so that nothing is optimized away
+struct scanned
+{
+    void operator()(int, int value)
+    {
+        keys += 1;
+        sum += static_cast<std::uint64_t>(value);
+    }
+
+    long keys{0};
+    std::uint64_t sum{0};
+};
+
+template <class Scan>
+void measure(std::string const& name, int keys, int repeat, Scan scan)
+{
+    util::timer t;
+    util::perf_counters counters;
+    scanned s;
+    for (auto i = 0; i < repeat; i++) {
+        s = {};
+        counters.start();
+        t.start();
+        scan(s);
+        t.stop();
+        counters.stop();
+    }
+    auto ns = t.elapsed_seconds() * 1e9 / (static_cast<double>(s.keys) * repeat);
+    std::cout << "    " << std::left << std::setw(24) << name << std::right
+        << std::fixed << std::setprecision(2)
+        << t.elapsed_milliseconds() / repeat << " ms, "
+        << ns << " ns/key, " << 1e3 / ns << " Mkeys/s, "
+        << s.keys << " keys" << (s.keys < keys ? " (missing keys)" : "") << "\n"
+        << std::defaultfloat;
+    std::cout << "    ";
+    counters.print(std::cout, static_cast<double>(s.keys) * repeat);
+}
+
+template <class Trie>
+void bench(std::string const& name, int keys, int writers, int repeat)
+{
+    std::cout << "testing [" << name << ", " << keys << " keys]\n";
+    Trie t;
+    util::timer fill_time;
+    fill_time.start();
+    fill(t, keys);
+    fill_time.stop();
+    std::cout << "    fill " << std::fixed << std::setprecision(2)
+        << fill_time.elapsed_milliseconds() << " ms\n" << std::defaultfloat;
+
+    measure("lookup of every key", keys, repeat, [&](scanned& s) {
+        for (auto key = 0; key < keys; key++)
+            if (auto v = t.lookup(key))
+                s(key, *v);
+    });
+    measure("for_each", keys, repeat, [&](scanned& s) {
+        t.for_each(s);
+    });
+    measure("iterator", keys, repeat, [&](scanned& s) {
+        for (auto [key, value] : t)
+            s(key, value);
+    });
+    {
+        auto v = t.snapshot();
+        measure("for_each of snapshot", keys, repeat, [&](scanned& s) {
+            v.for_each(s);
+        });
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<long> ops{0};
+    std::vector<std::thread> workers;
+    for (auto id = 0; id < writers; id++)
+        workers.emplace_back([&, id] {
+            util::fast_random gen{static_cast<std::uint64_t>(id) + 1};
+            long n = 0;
+            for (; !stop.load(std::memory_order_relaxed); n++) {
+                auto r = gen();
+                auto key = keys + static_cast<int>((r >> 32) % keys);
+                if (r % 2)
+                    t.insert(key, key);
+                else
+                    t.remove(key);
+            }
+            ops += n;
+        });
+    measure("for_each, " + std::to_string(writers) + " writers", keys, repeat, [&](scanned& s) {
+        t.for_each(s);
+    });
+    stop = true;
+    for (auto& th : workers)
+        th.join();
+    std::cout << "    writers: " << ops.load() << " updates\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    auto keys = argc > 1 ? std::atoi(argv[1]) : 50'000'000;
+    auto writers = argc > 2 ? std::atoi(argv[2]) : 2;
+    auto repeat = argc > 3 ? std::atoi(argv[3]) : 3;
+
+    using concurrent::epoch;
+    using concurrent::hazard;
+    bench<concurrent::trie<int, int, util::hash<int>, epoch>>("cache trie, epoch", keys, writers, repeat);
+    bench<concurrent::trie<int, int, util::hash<int>, hazard>>("cache trie, hazard", keys, writers, repeat);
+}
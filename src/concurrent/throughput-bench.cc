@@ -0,0 +1,122 @@
+// ml:ccf += -pthread
+#include <iostream>
+#include <vector>
+#include <string>
+#include <optional>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <cstdlib>
+#include "../util/throughput.hh"
+#include "../util/hash.hh"
+#include "trie.hh"
+
+// scaling of the cache trie against two lock based maps, for a read mostly
+// and a write heavy workload. with a third argument one operation in that
+// many is timed, and latency percentiles are printed per operation type.
+//
+// usage: throughput-bench [max threads] [duration ms] [latency sample]
+
+// std::unordered_map behind one reader writer lock
+struct locked_map
+{
+    auto lookup(int key) -> std::optional<int>
+    {
+        std::shared_lock lock{mutex};
+        auto it = value.find(key);
+        if (it == value.end())
+            return {};
+        return it->second;
+    }
+
+    void insert(int key, int v)
+    {
+        std::unique_lock lock{mutex};
+        value[key] = v;
+    }
+
+    auto remove(int key) -> std::optional<int>
+    {
+        std::unique_lock lock{mutex};
+        auto it = value.find(key);
+        if (it == value.end())
+            return {};
+        auto v = it->second;
+        value.erase(it);
+        return v;
+    }
+
+    std::shared_mutex mutex;
+    std::unordered_map<int, int> value;
+};
+
+// Stripes maps, each behind its own lock, picked by the hash of the key
+template <int Stripes = 64>
+struct striped_map
+{
+    struct alignas(64) stripe
+    {
+        std::mutex mutex;
+        std::unordered_map<int, int> value;
+    };
+
+    auto of(int key) -> stripe&
+    {
+        return stripes[util::mix_hash{}(key) % Stripes];
+    }
+
+    auto lookup(int key) -> std::optional<int>
+    {
+        auto& s = of(key);
+        std::lock_guard lock{s.mutex};
+        auto it = s.value.find(key);
+        if (it == s.value.end())
+            return {};
+        return it->second;
+    }
+
+    void insert(int key, int v)
+    {
+        auto& s = of(key);
+        std::lock_guard lock{s.mutex};
+        s.value[key] = v;
+    }
+
+    auto remove(int key) -> std::optional<int>
+    {
+        auto& s = of(key);
+        std::lock_guard lock{s.mutex};
+        auto it = s.value.find(key);
+        if (it == s.value.end())
+            return {};
+        auto v = it->second;
+        s.value.erase(it);
+        return v;
+    }
+
+    stripe stripes[Stripes];
+};
+
+int main(int argc, char** argv)
+{
+    auto hardware = static_cast<int>(std::thread::hardware_concurrency());
+    auto max_threads = argc > 1 ? std::atoi(argv[1]) : std::max(4, hardware);
+    auto counts = util::thread_counts(max_threads);
+
+    for (auto [lookup, insert, remove] : {std::tuple{90, 5, 5}, std::tuple{50, 25, 25}}) {
+        util::workload w;
+        w.lookup = lookup;
+        w.insert = insert;
+        w.remove = remove;
+        if (argc > 2)
+            w.duration = std::chrono::milliseconds{std::atoi(argv[2])};
+        if (argc > 3)
+            w.latency = std::atoi(argv[3]);
+        util::bench_scaling<concurrent::trie<int, int>>("cache trie, epoch", w, counts);
+        util::bench_scaling<concurrent::trie<int, int, util::hash<int>, concurrent::hazard>>(
+            "cache trie, hazard", w, counts);
+        util::bench_scaling<locked_map>("unordered_map, shared_mutex", w, counts);
+        util::bench_scaling<striped_map<>>("striped unordered_map, 64 stripes", w, counts);
+    }
+}
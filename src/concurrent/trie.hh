@@ -3,17 +3,36 @@
 #include <vector>
 #include <string>
 #include <utility>
-#include <memory>
 #include <optional>
 #include <atomic>
+#include <algorithm>
+#include <limits>
+#include <random>
 #include <any>
+#include <new>
+#include <iterator>
+#include <type_traits>
+#include <cstring>
+#include <cassert>
+#include <cstdint>
+#include "epoch.hh"
+#include "hazard.hh"
+#include "registry.hh"
+#include "backoff.hh"
+#include "double-word.hh"
+#include "node-pool.hh"
+#include "../util/bucket.hh"
+#include "../util/bulk.hh"
+#include "../util/hash.hh"
+#include "../util/stats.hh"
+#include "../util/image.hh"
 
 namespace concurrent
 {
 
-enum class node
+enum class node : std::uint8_t
 {
-    base,
+    empty,
     anode,
     snode,
     notxn,
@@ -22,12 +41,14 @@ enum class node
     fnode,
     enode,
     xnode,
+    lnode,
+    flnode,
 };
 
 std::ostream& operator<<(std::ostream& os, node const& n)
 {
     std::vector<std::string> name{
-        "base",
+        "empty",
         "anode",
         "snode",
         "notxn",
@@ -35,390 +56,1880 @@ std::ostream& operator<<(std::ostream& os, node const& n)
         "fvnode",
         "fnode",
         "enode",
+        "xnode",
+        "lnode",
+        "flnode",
     };
     os << name[static_cast<int>(n)];
     return os;
 }
 
-template <class Key, class T>
+// a pointer to a node with the kind of the node in its lowest four bits,
+// the allocators align every node to at least 16 bytes. the markers notxn,
+// fsnode and fvnode are the tag alone, and an fnode is the frozen anode
+// tagged as fnode, so none of them is allocated. likewise an flnode is a
+// frozen lnode.
+struct node_ptr
+{
+    static constexpr std::uintptr_t tag_mask = 0xf;
+    static_assert(__STDCPP_DEFAULT_NEW_ALIGNMENT__ > tag_mask);
+
+    constexpr node_ptr() = default;
+
+    constexpr explicit node_ptr(node kind)
+        : bits(static_cast<std::uintptr_t>(kind)) {}
+
+    node_ptr(void const* p, node kind)
+        : bits(reinterpret_cast<std::uintptr_t>(p) | static_cast<std::uintptr_t>(kind)) {}
+
+    template <class U>
+    explicit node_ptr(U* p) : node_ptr(p, U::kind) {}
+
+    explicit operator bool() const { return bits != 0; }
+
+    auto type() const -> node { return static_cast<node>(bits & tag_mask); }
+
+    auto address() const -> void* { return reinterpret_cast<void*>(bits & ~tag_mask); }
+
+    friend auto operator==(node_ptr a, node_ptr b) { return a.bits == b.bits; }
+    friend auto operator!=(node_ptr a, node_ptr b) { return a.bits != b.bits; }
+
+    std::uintptr_t bits{0};
+};
+
+template <class U>
+auto node_cast(node_ptr u) -> U*
+{
+    return static_cast<U*>(u.address());
+}
+
+// nodes are linked by tagged atomic pointers and reclaimed through Reclaimer,
+// either epoch or hazard. every public operation holds a Reclaimer::guard, and
+// every node read from a live slot is held by a Reclaimer::hazard_pointer
+// that was published before the slot was read a second time. a node is
+// retired by the thread whose CAS unlinked it.
+//
+// frozen nodes cannot be validated that way, their slots never change. they
+// are retired in a chain instead: the narrow node of an enode only after the
+// enode is freed, the anodes below the fnodes of a frozen node only after
+// that node is freed. whoever protects the head of a frozen subtree can walk
+// all of it. anodes shared with snapshots are counted, see unref, and the
+// chain goes on from the last of their parents.
+//
+// keys are hashed by Hash, see util/hash.hh, and hash_type is what it returns,
+// 64 bits by default. the overloads taking a hash leave hashing to the
+// caller. a level never reaches the width of the hash, since keys whose
+// hashes are equal share an lnode instead of a deeper anode.
+//
+// Backoff decides how long an update waits before it retries a slot, see
+// backoff.hh.
+//
+// values that fit a word are updated in place, see in_place.
+//
+// Allocator is where the nodes come from, see node-pool.hh: the heap, or
+// node_pool, which keeps what the trie frees for the nodes to come.
+template <
+    class Key,
+    class T,
+    class Hash = util::hash<Key>,
+    class Reclaimer = epoch,
+    class Backoff = no_backoff,
+    class Allocator = heap_allocator
+>
 struct trie
 {
-    using key_type   = Key;
-    using value_type = T;
-    using hash_type  = int;
+    using key_type       = Key;
+    using value_type     = T;
+    using hash_type      = util::hash_result_t<Hash, Key>;
+    using hasher         = Hash;
+    using reclaimer      = Reclaimer;
+    using guard          = typename reclaimer::guard;
+    using hazard_pointer = typename reclaimer::hazard_pointer;
+    using deleter_type   = typename reclaimer::deleter_type;
+    using backoff        = Backoff;
+    using allocator      = Allocator;
+
+    static_assert(allocator::granule > node_ptr::tag_mask);
+
+    // trivially copyable values of 1, 2, 4 or 8 bytes are overwritten in
+    // place in their snode, rather than by a new snode swapped in through
+    // txn. the value and the txn after it change together by a double word
+    // CAS, see update_in_place, so an snode that is frozen or replaced has
+    // its last value for good. such values are read by value, the others by
+    // reference.
+    static constexpr bool in_place = double_word::supported
+        && std::is_trivially_copyable_v<value_type>
+        && sizeof(value_type) <= 8
+        && (sizeof(value_type) & (sizeof(value_type) - 1)) == 0;
+
+    using value_reference = std::conditional_t<in_place, value_type, value_type const&>;
+
+    struct snode
+    {
+        static constexpr auto kind = node::snode;
+
+        snode(hash_type hash, key_type const& key, value_type const& value)
+            : hash(hash), key(key), value(value)
+        {
+            if constexpr (in_place) {
+                auto bytes = reinterpret_cast<char*>(&this->value);
+                std::memset(bytes + sizeof(value_type), 0, 8 - sizeof(value_type));
+                assert(reinterpret_cast<char*>(&txn) - bytes == 8);
+            }
+        }
+
+        hash_type hash;
+        key_type key;
+        alignas(in_place ? 16 : alignof(value_type)) value_type value;
+        std::atomic<node_ptr> txn{node_ptr{node::notxn}};
+    };
+
+    // the keys that share one full hash, see util::bucket. an lnode never
+    // changes once published, updates CAS a modified copy into its slot.
+    struct lnode
+    {
+        static constexpr auto kind = node::lnode;
+
+        lnode(hash_type hash) : hash(hash) {}
+
+        hash_type hash;
+        util::bucket<key_type, value_type> entries;
+    };
 
-    struct base_node
+    // narrow (4) or wide (16) array, a narrow one only ever holds leaves,
+    // see insert. removals count what is left in the slots and compress an
+    // anode that became sparse, see compress.
+    // gen is the generation of the trie the anode was made for, an update
+    // only writes to anodes of its own generation and copies the others,
+    // see snapshot. refs counts the slots and roots pointing to it, more
+    // than one once a snapshot shares it.
+    struct anode
     {
-        virtual auto type() const -> node { return node::base; }
+        static constexpr auto kind = node::anode;
+
+        // the slots follow the anode in its block, see make_anode
+        struct slots
+        {
+            auto size() const -> std::size_t { return n; }
+            auto operator[](std::size_t i) const -> std::atomic<node_ptr>& { return first[i]; }
+            auto begin() const { return first; }
+            auto end() const { return first + n; }
+
+            std::atomic<node_ptr>* first;
+            std::size_t n;
+        };
+
+        anode(int size, std::uint64_t gen)
+            : values{reinterpret_cast<std::atomic<node_ptr>*>(this + 1), static_cast<std::size_t>(size)},
+              gen(gen)
+        {
+            for (auto& v : values)
+                new (&v) std::atomic<node_ptr>{node_ptr{}};
+        }
+
+        anode(anode const&) = delete;
+        anode& operator=(anode const&) = delete;
+
+        static auto bytes(std::size_t size) -> std::size_t
+        {
+            return sizeof(anode) + size * sizeof(std::atomic<node_ptr>);
+        }
+
+        slots values;
+        std::uint64_t gen;
+        std::atomic<int> refs{1};
     };
 
-    struct notxn : base_node
+    struct enode
+    {
+        static constexpr auto kind = node::enode;
+
+        enode(
+            anode* parent,
+            int parent_pos,
+            anode* narrow,
+            hash_type hash,
+            int level
+        ) : parent(parent), parent_pos(parent_pos), narrow(narrow), hash(hash), level(level)
+        {
+        }
+
+        anode* parent;
+        int parent_pos;
+        anode* narrow;
+        hash_type hash;
+        std::atomic<anode*> wide{nullptr};
+        int level;
+    };
+
+    struct xnode
+    {
+        static constexpr auto kind = node::xnode;
+
+        xnode(
+            anode* parent,
+            int parent_pos,
+            anode* stale,
+            hash_type hash,
+            int level
+        ) : parent(parent), parent_pos(parent_pos), stale(stale), hash(hash), level(level)
+        {
+        }
+
+        anode* parent;
+        int parent_pos;
+        anode* stale;
+        hash_type hash;
+        int level;
+    };
+
+    // nodes unlinked while a cache is current may still be reachable from
+    // its entries, they are retired only when the cache is replaced, see
+    // retire_unlinked.
+    struct buried
+    {
+        void* ptr;
+        deleter_type deleter;
+        buried* next;
+    };
+
+    // the auxiliary cache of the paper, it holds the anodes at one level of
+    // the trie, indexed by the lowest `level` bits of the hash. entries may
+    // be empty or stale, a stale entry is detected by the frozen slots of the
+    // node it points to. an entry is only trusted while its cache is the
+    // current one.
+    struct cache_node
+    {
+        cache_node(int level) : level(level), values(1 << level) {}
+
+        // nodes buried after the cache was released
+        ~cache_node() { release(); }
+
+        void release()
+        {
+            auto u = graveyard.exchange(nullptr);
+            while (u) {
+                auto next = u->next;
+                reclaimer::retire(u->ptr, u->deleter);
+                dispose(u);
+                u = next;
+            }
+        }
+
+        int level;
+        std::vector<std::atomic<anode*>> values;
+        std::atomic<buried*> graveyard{nullptr};
+        std::atomic<int> graveyard_size{0};
+    };
+
+    // a read only snapshot, see snapshot. it shares the anodes of the trie,
+    // which copies them before it writes below them, and may outlive it.
+    struct view
+    {
+        view(anode* root, hasher const& hash_function)
+            : root(root), hash_function(hash_function) {}
+
+        view(view&& other) noexcept
+            : root(std::exchange(other.root, nullptr)), hash_function(other.hash_function) {}
+
+        view& operator=(view&& other) noexcept
+        {
+            std::swap(root, other.root);
+            std::swap(hash_function, other.hash_function);
+            return *this;
+        }
+
+        ~view()
+        {
+            if (root)
+                reclaimer::retire(root, unref);
+        }
+
+        auto lookup(key_type const& key) const -> std::optional<value_type>
+        {
+            return lookup(key, static_cast<hash_type>(hash_function(key)));
+        }
+
+        auto lookup(key_type const& key, hash_type hash) const -> std::optional<value_type>
+        {
+            guard g;
+            return trie::lookup(key, hash, 0, root, nullptr);
+        }
+
+        // every key of the snapshot exactly once, see trie::begin
+        auto begin() const { return iterator{root}; }
+
+        auto end() const { return typename iterator::sentinel{}; }
+
+        template <class F>
+        void for_each(F&& fn) const
+        {
+            for (auto it = begin(); it != end(); ++it)
+                fn(it.key(), it.value());
+        }
+
+        // see trie::stats, nothing of the snapshot is pending but what the
+        // reclaimer holds
+        auto stats() const -> util::trie_stats
+        {
+            guard g;
+            return trie::stats(root, nullptr);
+        }
+
+        void write_dot(std::ostream& os) const
+        {
+            guard g;
+            trie::write_dot(os, root);
+        }
+
+        // the snapshot as an image file, see util::image. false if the file
+        // could not be written, errno says why.
+        auto save(std::string const& path) const -> bool
+        {
+            guard g;
+            util::image::writer<key_type, value_type, hash_type> w{path};
+            std::uint64_t none[16] = {};
+            auto r = trie::save(w, root);
+            return w.finish(r ? r : w.anode(none, 16));
+        }
+
+        // frozen, so its slots never change
+        anode* root;
+        hasher hash_function;
+    };
+
+    // the root and hash an update of this thread started from, published
+    // for snapshot while the update runs, see settle.
+    struct announcement
+    {
+        struct alignas(64) record
+        {
+            std::atomic<anode*> root{nullptr};
+            std::atomic<hash_type> hash{};
+            std::atomic<bool> in_use{true};
+            record* next{nullptr};
+
+            void exit() {}
+        };
+
+        using records = registry<record>;
+
+        announcement() : rec(records::local()) {}
+
+        ~announcement() { rec.root.store(nullptr, std::memory_order_release); }
+
+        announcement(announcement const&) = delete;
+        announcement& operator=(announcement const&) = delete;
+
+        record& rec;
+    };
+
+    static constexpr int hash_bits = std::numeric_limits<hash_type>::digits;
+    static_assert(hash_bits % 4 == 0);
+
+    // the anodes an update walked through from where it started, and what it
+    // read from their slots. every depth has its own hazard pointer, taken
+    // the first time the walk gets that deep, so an update that finds its
+    // anode frozen backs up to the nearest ancestor it can still change
+    // rather than to root.
+    struct path
+    {
+        static constexpr int max_depth = hash_bits / 4;
+
+        path() = default;
+        path(path const&) = delete;
+        path& operator=(path const&) = delete;
+
+        // hazard pointers are released in reverse order
+        ~path()
+        {
+            while (taken)
+                at(--taken).~hazard_pointer();
+        }
+
+        // the node below nodes[depth], depth is at most one deeper than any
+        // before
+        auto protect(int depth, std::atomic<node_ptr> const& slot) -> node_ptr
+        {
+            if (depth == taken)
+                new (hazards[taken++]) hazard_pointer;
+            return at(depth).protect(slot);
+        }
+
+        auto at(int depth) -> hazard_pointer&
+        {
+            return *std::launder(reinterpret_cast<hazard_pointer*>(hazards[depth]));
+        }
+
+        anode* nodes[max_depth];
+        int taken{0};
+        alignas(hazard_pointer) unsigned char hazards[max_depth][sizeof(hazard_pointer)];
+    };
+
+    // a weakly consistent iterator, see begin. it walks depth first with a
+    // path, pos holds the slot it is at in every anode of the path, and the
+    // hazard pointer of a depth protects what it read from that slot: the
+    // anode below, the enode or xnode whose frozen node is below, or the
+    // snode or lnode it is at. like an update it holds a guard and hazard
+    // pointers, so it can not be copied and is destroyed before any hazard
+    // pointer taken before it.
+    struct iterator
+    {
+        struct sentinel {};
+
+        // the root of a view, frozen and held by the view
+        explicit iterator(anode* root) { start(root); }
+
+        explicit iterator(std::atomic<anode*> const& root) { start(hr.protect(root)); }
+
+        iterator(iterator const&) = delete;
+        iterator& operator=(iterator const&) = delete;
+
+        auto key() const -> key_type const&
+        {
+            return b ? b->keys[i] : node_cast<snode>(leaf)->key;
+        }
+
+        auto value() const -> value_reference
+        {
+            if (b)
+                return b->values[i];
+            return load(node_cast<snode>(leaf));
+        }
+
+        auto operator*() const -> std::pair<key_type const&, value_reference>
+        {
+            return {key(), value()};
+        }
+
+        // only the last bucket of an lnode is partly filled, none is empty
+        auto operator++() -> iterator&
+        {
+            if (b && ++i == b->size) {
+                b = b->next;
+                i = 0;
+            }
+            if (!b) {
+                pos[depth] += 1;
+                settle();
+            }
+            return *this;
+        }
+
+        friend auto operator==(iterator const& it, sentinel) { return it.depth < 0; }
+        friend auto operator!=(iterator const& it, sentinel) { return it.depth >= 0; }
+
+        void start(anode* root)
+        {
+            p.nodes[0] = root;
+            pos[0] = 0;
+            settle();
+        }
+
+        // moves on to the first key at or after the slot at pos[depth], an
+        // enode or xnode is walked through to the frozen node it replaces.
+        void settle()
+        {
+            while (depth >= 0) {
+                auto cur = p.nodes[depth];
+                if (pos[depth] == static_cast<int>(cur->values.size())) {
+                    if (--depth >= 0)
+                        pos[depth] += 1;
+                    continue;
+                }
+                auto u = p.protect(depth, cur->values[pos[depth]]);
+                anode* next = nullptr;
+                if (u.type() == node::snode) {
+                    leaf = u;
+                    return;
+                } else if (u.type() == node::lnode || u.type() == node::flnode) {
+                    b = &node_cast<lnode>(u)->entries;
+                    i = 0;
+                    return;
+                } else if (u.type() == node::anode || u.type() == node::fnode) {
+                    next = node_cast<anode>(u);
+                } else if (u.type() == node::enode) {
+                    next = node_cast<enode>(u)->narrow;
+                } else if (u.type() == node::xnode) {
+                    next = node_cast<xnode>(u)->stale;
+                }
+                if (next) {
+                    p.nodes[++depth] = next;
+                    pos[depth] = 0;
+                } else {
+                    pos[depth] += 1;
+                }
+            }
+        }
+
+        guard g;
+        hazard_pointer hr;
+        path p;
+        int pos[path::max_depth];
+        int depth{0};
+        node_ptr leaf;
+        util::bucket<key_type, value_type> const* b{nullptr};
+        int i{0};
+    };
+
+    static constexpr int min_cache_level      = 8;
+    static constexpr int max_cache_level      = 20;
+    static constexpr int cache_miss_threshold = 2048;
+    static constexpr int cache_samples        = 256;
+    static constexpr int min_graveyard_size   = 64;
+
+    trie() = default;
+    trie(trie const&) = delete;
+    trie& operator=(trie const&) = delete;
+
+    // a trie that starts out with the keys of v, in constant time. the two
+    // share the anodes of v until either writes below them.
+    explicit trie(view const& v)
+        : root{copy(v.root, new_generation())}, hash_function{v.hash_function} {}
+
+    // a trie with the keys of an image, see util::mapped_trie, copied node
+    // by node, the subtrees of the root slots on threads threads.
+    explicit trie(util::mapped_trie<Key, T, Hash> const& image, int threads = util::hardware_threads())
+    {
+        if (!image)
+            return;
+        using image_type = util::mapped_trie<Key, T, Hash>;
+        auto r = root.load(std::memory_order_relaxed);
+        auto top = image.template node<typename image_type::anode>(image.root());
+        util::parallel_tasks(threads, static_cast<int>(top->size), [&](int s) {
+            r->values[s].store(thaw(image, top->slots()[s], r->gen), std::memory_order_relaxed);
+        });
+    }
+
+    // the trie must be quiescent when it is destroyed
+    ~trie()
+    {
+        destroy(node_ptr{root.load()});
+        delete cache.load();
+    }
+
+    // lookups never back up, they only need the anode they are in and the
+    // one below protected, three pointers in turn as in sample_level.
+    static auto lookup(
+        key_type const& key,
+        hash_type hash,
+        int level,
+        anode* cur,
+        cache_node* c
+    ) -> std::optional<value_type>
+    {
+        hazard_pointer hp[3];
+        for (auto depth = 0; ; depth++) {
+            if (c && level == c->level)
+                inhabit(c, cur, hash);
+            auto pos = (hash >> level) & ((cur->values).size() - 1);
+            auto old = hp[depth % 3].protect(cur->values[pos]);
+            if (!old || old.type() == node::fvnode) {
+                return {};
+            } else if (old.type() == node::anode || old.type() == node::fnode) {
+                cur = node_cast<anode>(old);
+            } else if (old.type() == node::snode) {
+                auto oldsn = node_cast<snode>(old);
+                if (oldsn->key == key)
+                    return load(oldsn);
+                else
+                    return {};
+            } else if (old.type() == node::lnode || old.type() == node::flnode) {
+                return find(node_cast<lnode>(old), key, hash);
+            } else if (old.type() == node::enode) {
+                cur = node_cast<enode>(old)->narrow;
+            } else if (old.type() == node::xnode) {
+                cur = node_cast<xnode>(old)->stale;
+            } else {
+                // TODO throw error, unexpected case
+                return {};
+            }
+            level += 4;
+        }
+    }
+
+    // lookup starting from a cached anode, the first element is false if the
+    // cached path turned out to be stale and the caller has to walk from root.
+    // ending below the cache level counts as a miss, so that the cache level
+    // follows the trie as it grows.
+    auto fast_lookup(
+        key_type const& key,
+        hash_type hash,
+        int level,
+        anode* cur,
+        cache_node* c
+    ) -> std::pair<bool, std::optional<value_type>>
+    {
+        hazard_pointer hp[3];
+        for (auto depth = 0; ; depth++) {
+            auto pos = (hash >> level) & ((cur->values).size() - 1);
+            auto old = hp[depth % 3].protect(cur->values[pos]);
+            if (!old) {
+                if (level != c->level)
+                    record_cache_miss();
+                return {true, {}};
+            } else if (old.type() == node::anode) {
+                cur = node_cast<anode>(old);
+                level += 4;
+                continue;
+            } else if (old.type() == node::snode) {
+                auto oldsn = node_cast<snode>(old);
+                if (oldsn->txn.load().type() == node::fsnode)
+                    return {false, {}};
+                if (level != c->level)
+                    record_cache_miss();
+                if (oldsn->key == key)
+                    return {true, load(oldsn)};
+                else
+                    return {true, {}};
+            } else if (old.type() == node::lnode) {
+                if (level != c->level)
+                    record_cache_miss();
+                return {true, find(node_cast<lnode>(old), key, hash)};
+            }
+            // fvnode, fnode, flnode, enode and xnode all mean the node is
+            // (being) replaced
+            return {false, {}};
+        }
+    }
+
+    auto hash(key_type const& key) const -> hash_type
+    {
+        return static_cast<hash_type>(hash_function(key));
+    }
+
+    auto lookup(key_type const& key) -> std::optional<value_type>
+    {
+        return lookup(key, hash(key));
+    }
+
+    auto lookup(key_type const& key, hash_type hash) -> std::optional<value_type>
+    {
+        guard g;
+        hazard_pointer hc, ha;
+        auto c = hc.protect(cache);
+        if (auto cur = cached(c, hash, ha)) {
+            auto res = fast_lookup(key, hash, c->level, cur, c);
+            if (res.first)
+                return res.second;
+        }
+        record_cache_miss();
+        // a snapshot may swap root and retire the old one meanwhile
+        hazard_pointer hr;
+        return lookup(key, hash, 0, hr.protect(root), c);
+    }
+
+    // a lookup of lookup_many in flight, h is its row of hazard pointers
+    struct probe
+    {
+        enum stage_type { locate, read, leaf };
+
+        std::size_t index;
+        hash_type hash;
+        int level;
+        int h;
+        stage_type stage;
+        anode* cur;
+        std::atomic<node_ptr> const* slot;
+        node_ptr found;
+    };
+
+    // more lookups in flight hide more latency, 16 keep their hazard
+    // pointers well within those of a thread
+    static constexpr int lookup_group = 16;
+
+    // lookups of keys[i] into out[i], for random access ranges keys and out,
+    // the latter of std::optional<value_type>. lookup_group of them are
+    // walked at a time, interleaved, each a step of its own at a turn: from
+    // an anode to its slot, from the slot to the node below, from a leaf to
+    // the result. every step prefetches what the next one of its lookup
+    // loads, so that the misses of a group overlap rather than follow one
+    // another. every walk starts from root, like the lookup after a cache
+    // miss, and protects three nodes in turn, as lookup does.
+    template <class Keys, class Out>
+    void lookup_many(Keys const& keys, Out& out)
+    {
+        auto k = std::begin(keys);
+        auto o = std::begin(out);
+        auto n = static_cast<std::size_t>(std::distance(k, std::end(keys)));
+        guard g;
+        hazard_pointer hp[lookup_group][3];
+        probe probes[lookup_group];
+        auto active = 0;
+        std::size_t next = 0;
+        auto start = [&](probe& p) {
+            p.index = next++;
+            p.hash = hash(k[p.index]);
+            p.level = 0;
+            p.cur = hp[p.h][2].protect(root);
+            p.stage = probe::locate;
+        };
+        for (; active < lookup_group && next < n; active++) {
+            probes[active].h = active;
+            start(probes[active]);
+        }
+        while (active) {
+            for (auto i = 0; i < active; ) {
+                auto& p = probes[i];
+                if (!step(p, k[p.index], o[p.index], hp[p.h])) {
+                    i++;
+                } else if (next < n) {
+                    start(p);
+                    i++;
+                } else {
+                    std::swap(p, probes[--active]);
+                }
+            }
+        }
+    }
+
+    // one step of p, true once its result is in out. the node read at level
+    // is protected by hp[level / 4 % 3], root by hp[2].
+    template <class Out>
+    static auto step(probe& p, key_type const& key, Out& out, hazard_pointer* hp) -> bool
+    {
+        if (p.stage == probe::locate) {
+            auto pos = (p.hash >> p.level) & (p.cur->values.size() - 1);
+            p.slot = &p.cur->values[pos];
+            __builtin_prefetch(p.slot);
+            p.stage = probe::read;
+            return false;
+        } else if (p.stage == probe::read) {
+            auto u = hp[p.level / 4 % 3].protect(*p.slot);
+            anode* next = nullptr;
+            if (!u || u.type() == node::fvnode) {
+                out = std::nullopt;
+                return true;
+            } else if (u.type() == node::anode || u.type() == node::fnode) {
+                next = node_cast<anode>(u);
+            } else if (u.type() == node::enode) {
+                next = node_cast<enode>(u)->narrow;
+            } else if (u.type() == node::xnode) {
+                next = node_cast<xnode>(u)->stale;
+            } else {
+                p.found = u;
+                __builtin_prefetch(u.address());
+                p.stage = probe::leaf;
+                return false;
+            }
+            __builtin_prefetch(next);
+            p.cur = next;
+            p.level += 4;
+            p.stage = probe::locate;
+            return false;
+        }
+        if (p.found.type() == node::snode) {
+            auto sn = node_cast<snode>(p.found);
+            if (sn->key == key)
+                out = load(sn);
+            else
+                out = std::nullopt;
+        } else {
+            out = find(node_cast<lnode>(p.found), key, p.hash);
+        }
+        return true;
+    }
+
+    // CAS failures retry at the same level after a backoff, an anode that
+    // turned out frozen makes the walk back up to its parent, and so on until
+    // a slot changes.
+    // key gets the value f(old), old being the value it had if any, which is
+    // returned. f may be called more than once, with the value of another
+    // round every time.
+    // the first element is false only if it has to back up above cur, which
+    // it can not from root.
+    template <class F>
+    auto insert(
+        key_type const& key,
+        hash_type hash,
+        int level,
+        anode* cur,
+        cache_node* c,
+        F& f
+    ) -> std::pair<bool, std::optional<value_type>>
+    {
+        path p;
+        p.nodes[0] = cur;
+        auto depth = 0;
+        backoff b;
+        while (true) {
+            if (c && level == c->level)
+                inhabit(c, cur, hash);
+            auto pos = (hash >> level) & ((cur->values).size() - 1);
+            auto old = p.protect(depth, cur->values[pos]);
+            auto up = false;
+            if (!old) {
+                auto sn = make<snode>(hash, key, f(std::nullopt));
+                if (cur->values[pos].compare_exchange_weak(old, node_ptr{sn}))
+                    return {true, std::nullopt};
+                dispose(sn);
+                b.failed();
+            } else if (old.type() == node::anode) {
+                if (node_cast<anode>(old)->gen != cur->gen) {
+                    renew(cur->values[pos], old, cur->gen);
+                    continue;
+                }
+                cur = node_cast<anode>(old);
+                p.nodes[++depth] = cur;
+                level += 4;
+            } else if (old.type() == node::snode) {
+                auto u = node_cast<snode>(old);
+                auto txn = u->txn.load();
+                if (txn.type() == node::notxn) {
+                    if (u->key == key) {
+                        if constexpr (in_place) {
+                            if (auto res = update_in_place(u, f, b))
+                                return {true, res};
+                            continue;
+                        } else {
+                            auto sn = make<snode>(hash, key, f(u->value));
+                            if (u->txn.compare_exchange_weak(txn, node_ptr{sn})) {
+                                if (cur->values[pos].compare_exchange_strong(old, node_ptr{sn}))
+                                    reclaimer::retire(u, dispose_as<snode>);
+                                return {true, u->value};
+                            }
+                            dispose(sn);
+                            b.failed();
+                        }
+                    } else if (u->hash != hash && cur->values.size() == 4) {
+                        expand(hash, level, p, depth);
+                        up = true;
+                    } else {
+                        auto w = read(u);
+                        auto an = create_anode(
+                            u->hash, u->key, value_of(u, w),
+                            hash, key, f(std::nullopt),
+                            level + 4, cur->gen
+                        );
+                        if (commit(u, txn, an, w)) {
+                            if (cur->values[pos].compare_exchange_strong(old, an))
+                                reclaimer::retire(u, dispose_as<snode>);
+                            return {true, std::nullopt};
+                        }
+                        destroy(an);
+                        b.failed();
+                    }
+                } else if (txn.type() == node::fsnode) {
+                    up = true;
+                } else {
+                    if (cur->values[pos].compare_exchange_strong(old, txn))
+                        reclaimer::retire(u, dispose_as<snode>);
+                    b.failed();
+                }
+            } else if (old.type() == node::lnode) {
+                auto ln = node_cast<lnode>(old);
+                node_ptr nu;
+                std::optional<value_type> res;
+                if (ln->hash == hash) {
+                    res = find(ln, key, hash);
+                    auto nl = make<lnode>(*ln);
+                    nl->entries.assign(key, f(res));
+                    nu = node_ptr{nl};
+                } else if (cur->values.size() == 4) {
+                    expand(hash, level, p, depth);
+                    up = true;
+                } else {
+                    nu = create_anode(
+                        node_ptr{make<lnode>(*ln)},
+                        node_ptr{make<snode>(hash, key, f(std::nullopt))},
+                        level + 4, cur->gen
+                    );
+                }
+                if (nu) {
+                    if (cur->values[pos].compare_exchange_weak(old, nu)) {
+                        reclaimer::retire(ln, dispose_as<lnode>);
+                        return {true, res};
+                    }
+                    destroy(nu);
+                    b.failed();
+                }
+            } else if (old.type() == node::enode) {
+                complete_expansion(old);
+                b.failed();
+            } else if (old.type() == node::xnode) {
+                complete_compression(old);
+                b.failed();
+            } else {
+                // fvnode, fnode or flnode, cur is frozen
+                up = true;
+            }
+            if (up) {
+                if (depth == 0)
+                    return {false, std::nullopt};
+                cur = p.nodes[--depth];
+                level -= 4;
+            }
+        }
+    }
+
+    // the value of sn, read at once with in_place values
+    static auto load(snode const* sn) -> value_reference
+    {
+        if constexpr (in_place)
+            return value_of(sn, read(sn));
+        else
+            return sn->value;
+    }
+
+    // the word holding the value of sn, if in_place
+    static auto read(snode const* sn) -> std::uint64_t
+    {
+        if constexpr (in_place)
+            return double_word::load(reinterpret_cast<double_word::word const*>(&sn->value));
+        else
+            return 0;
+    }
+
+    // the value of sn as held by w, a word read from it
+    static auto value_of(snode const* sn, std::uint64_t w) -> value_reference
+    {
+        if constexpr (in_place) {
+            value_type v;
+            std::memcpy(&v, &w, sizeof(value_type));
+            return v;
+        } else {
+            return sn->value;
+        }
+    }
+
+    // the txn of u from notxn to desired, with in_place values only if u
+    // still holds the value of w, which desired was made from
+    static auto commit(snode* u, node_ptr& txn, node_ptr desired, std::uint64_t w) -> bool
+    {
+        if constexpr (in_place) {
+            double_word::pair expected{w, txn.bits};
+            if (double_word::compare_exchange(words(u), expected, {w, desired.bits}))
+                return true;
+            txn.bits = expected.hi;
+            return false;
+        } else {
+            return u->txn.compare_exchange_weak(txn, desired);
+        }
+    }
+
+    static auto words(snode* u) -> double_word::pair*
+    {
+        return reinterpret_cast<double_word::pair*>(&u->value);
+    }
+
+    // the value of u replaced by f(value) as long as u is neither frozen nor
+    // replaced, the txn is compared along with the value. returns the value
+    // it had, or nothing if txn is no longer notxn.
+    template <class F>
+    static auto update_in_place(snode* u, F& f, backoff& b) -> std::optional<value_type>
+    {
+        constexpr auto notxn = node_ptr{node::notxn}.bits;
+        double_word::pair expected{read(u), notxn};
+        while (true) {
+            auto old = value_of(u, expected.lo);
+            auto v = f(std::optional<value_type>{old});
+            auto w = expected.lo;
+            std::memcpy(&w, &v, sizeof(value_type));
+            if (double_word::compare_exchange(words(u), expected, {w, notxn}))
+                return old;
+            if (expected.hi != notxn)
+                return {};
+            b.failed();
+        }
+    }
+
+    // replaces the narrow node at depth of p by a wide one, the insert goes on
+    // from the parent. started from a cached node the parent is unknown, the
+    // insert is left to the walk from root.
+    void expand(hash_type hash, int level, path& p, int depth)
+    {
+        if (depth == 0)
+            return;
+        auto cur = p.nodes[depth];
+        auto prev = p.nodes[depth - 1];
+        auto ppos = (hash >> (level - 4)) & (prev->values.size() - 1);
+        auto en = make<enode>(prev, ppos, cur, hash, level);
+        // once published, en may be completed and retired by anyone
+        hazard_pointer he;
+        he.set(en);
+        node_ptr expected{cur};
+        if (prev->values[ppos].compare_exchange_strong(expected, node_ptr{en}))
+            complete_expansion(node_ptr{en});
+        else
+            dispose(en);
+    }
+
+    void insert(key_type const& key, value_type const& value)
+    {
+        insert(key, value, hash(key));
+    }
+
+    void insert(key_type const& key, value_type const& value, hash_type hash)
+    {
+        exchange(key, value, hash);
+    }
+
+    // insert, and the value key had, if any
+    auto exchange(key_type const& key, value_type const& value) -> std::optional<value_type>
+    {
+        return exchange(key, value, hash(key));
+    }
+
+    auto exchange(key_type const& key, value_type const& value, hash_type hash)
+        -> std::optional<value_type>
+    {
+        return update(key, hash, [&](std::optional<value_type> const&) { return value; });
+    }
+
+    // adds delta to the value of key, or inserts key with delta, and returns
+    // the value key had, if any
+    auto fetch_add(key_type const& key, value_type const& delta) -> std::optional<value_type>
+    {
+        return fetch_add(key, delta, hash(key));
+    }
+
+    auto fetch_add(key_type const& key, value_type const& delta, hash_type hash)
+        -> std::optional<value_type>
+    {
+        return update(key, hash, [&](std::optional<value_type> const& old) -> value_type {
+            return old ? *old + delta : delta;
+        });
+    }
+
+    // gives key the value f(old), old being the value key had, if any, and
+    // returns old, as one atomic step. f may be called more than once, every
+    // time with the value of another round. an in_place value is updated in
+    // its snode, nothing is allocated.
+    template <class F>
+    auto update(key_type const& key, F&& f) -> std::optional<value_type>
+    {
+        return update(key, hash(key), f);
+    }
+
+    // a cached anode of an older generation is not written to, and a root
+    // frozen by a snapshot sends the update round again from the new one.
+    template <class F>
+    auto update(key_type const& key, hash_type hash, F&& f) -> std::optional<value_type>
+    {
+        guard g;
+        announcement a;
+        while (true) {
+            hazard_pointer hr;
+            auto r = enter(a, hash, hr);
+            hazard_pointer hc, ha;
+            auto c = hc.protect(cache);
+            if (auto cur = cached(c, hash, ha); cur && cur->gen == r->gen) {
+                auto res = insert(key, hash, c->level, cur, c, f);
+                if (res.first)
+                    return res.second;
+            }
+            record_cache_miss();
+            auto res = insert(key, hash, 0, r, c, f);
+            if (res.first)
+                return res.second;
+        }
+    }
+
+    // the pairs of items, a random access range, as if they were inserted in
+    // order, on threads threads. the batch is hashed and split by root slot,
+    // see util::hashed_batch, and the subtree of every root slot is built
+    // apart by sequential_insert, without CAS or expansions of published
+    // nodes, then published by one CAS into the empty slot. the pairs of a
+    // slot that is taken, by keys loaded before or updates running alongside,
+    // are inserted one by one.
+    template <class Range>
+    void bulk_load(Range const& items, int threads = util::hardware_threads())
+    {
+        auto first = std::begin(items);
+        auto n = static_cast<std::size_t>(std::distance(first, std::end(items)));
+        util::hashed_batch<hash_type> batch{n, [&](std::size_t i) {
+            auto const& [key, value] = first[i];
+            return hash(key);
+        }, threads};
+        util::parallel_tasks(threads, batch.slots, [&](int s) {
+            guard g;
+            hazard_pointer hr;
+            auto r = hr.protect(root);
+            if (!r->values[s].load()) {
+                auto holder = make_anode(16, r->gen);
+                batch.for_each_run(s, [&](std::size_t i, std::size_t j) {
+                    sequential_insert(bulk_leaf(batch, first, i, j), holder, 0);
+                });
+                node_ptr expected;
+                auto built = holder->values[s].load(std::memory_order_relaxed);
+                dispose(holder);
+                if (r->values[s].compare_exchange_strong(expected, built))
+                    return;
+                destroy(built);
+            }
+            for (auto i = batch.begin(s); i < batch.end(s); i++) {
+                auto const& [key, value] = first[batch.entries[i].second];
+                insert(key, value, batch.entries[i].first);
+            }
+        });
+    }
+
+    // the leaf of the pairs of the entries [i, j) of batch, which share a
+    // hash: an lnode if there is more than one key among them, an snode of
+    // the last pair otherwise.
+    template <class Batch, class Iterator>
+    static auto bulk_leaf(Batch const& batch, Iterator first, std::size_t i, std::size_t j) -> node_ptr
+    {
+        auto hash = batch.entries[i].first;
+        if (j - i > 1) {
+            auto ln = make<lnode>(hash);
+            for (auto k = i; k < j; k++) {
+                auto const& [key, value] = first[batch.entries[k].second];
+                ln->entries.assign(key, value);
+            }
+            if (ln->entries.count() > 1)
+                return node_ptr{ln};
+            dispose(ln);
+        }
+        auto const& [key, value] = first[batch.entries[j - 1].second];
+        return node_ptr{make<snode>(hash, key, value)};
+    }
+
+    // walks like insert, the first element is false if it had to back up
+    // above cur. r is the root the walk went to cur from, see compress.
+    auto remove(
+        key_type const& key,
+        hash_type hash,
+        int level,
+        anode* cur,
+        anode* r
+    ) -> std::pair<bool, std::optional<value_type>>
+    {
+        path p;
+        p.nodes[0] = cur;
+        auto depth = 0;
+        backoff b;
+        while (true) {
+            auto pos = (hash >> level) & ((cur->values).size() - 1);
+            auto old = p.protect(depth, cur->values[pos]);
+            auto up = false;
+            if (!old) {
+                return {true, {}};
+            } else if (old.type() == node::anode) {
+                if (node_cast<anode>(old)->gen != cur->gen) {
+                    renew(cur->values[pos], old, cur->gen);
+                    continue;
+                }
+                cur = node_cast<anode>(old);
+                p.nodes[++depth] = cur;
+                level += 4;
+            } else if (old.type() == node::snode) {
+                auto oldsn = node_cast<snode>(old);
+                auto txn = oldsn->txn.load();
+                if (txn.type() == node::notxn) {
+                    if (oldsn->hash == hash && oldsn->key == key) {
+                        if (oldsn->txn.compare_exchange_weak(txn, node_ptr{})) {
+                            auto value = oldsn->value;
+                            if (cur->values[pos].compare_exchange_strong(old, node_ptr{}))
+                                reclaimer::retire(oldsn, dispose_as<snode>);
+                            compress(hash, level, p, depth, r);
+                            return {true, value};
+                        }
+                        b.failed();
+                    } else {
+                        return {true, {}};
+                    }
+                } else if (txn.type() == node::fsnode) {
+                    up = true;
+                } else {
+                    if (cur->values[pos].compare_exchange_strong(old, txn))
+                        reclaimer::retire(oldsn, dispose_as<snode>);
+                    b.failed();
+                }
+            } else if (old.type() == node::lnode) {
+                auto ln = node_cast<lnode>(old);
+                auto res = find(ln, key, hash);
+                if (!res)
+                    return {true, {}};
+                // the last but one key leaves an snode behind
+                node_ptr nu;
+                if (ln->entries.count() == 2) {
+                    auto i = ln->entries.keys[0] == key ? 1 : 0;
+                    nu = node_ptr{make<snode>(hash, ln->entries.keys[i], ln->entries.values[i])};
+                } else {
+                    auto nl = make<lnode>(*ln);
+                    nl->entries.erase(key);
+                    nu = node_ptr{nl};
+                }
+                if (cur->values[pos].compare_exchange_weak(old, nu)) {
+                    reclaimer::retire(ln, dispose_as<lnode>);
+                    return {true, res};
+                }
+                destroy(nu);
+                b.failed();
+            } else if (old.type() == node::enode) {
+                complete_expansion(old);
+                b.failed();
+            } else if (old.type() == node::xnode) {
+                complete_compression(old);
+                b.failed();
+            } else {
+                // fvnode, fnode or flnode, cur is frozen
+                up = true;
+            }
+            if (up) {
+                if (depth == 0)
+                    return {false, {}};
+                cur = p.nodes[--depth];
+                level -= 4;
+            }
+        }
+    }
+
+    // after a removal from the anode at depth of p, replaces it by an xnode
+    // while it is sparse, see complete_compression, and goes on with its
+    // parent as long as that leaves a leaf or nothing in the parent. the
+    // anode a removal started from has no parent in p, if it was a cached
+    // one its path is walked again from r.
+    void compress(hash_type hash, int level, path& p, int depth, anode* r)
+    {
+        while (depth > 0 && sparse(p.nodes[depth], level)) {
+            auto cur = p.nodes[depth];
+            auto prev = p.nodes[depth - 1];
+            auto ppos = (hash >> (level - 4)) & (prev->values.size() - 1);
+            auto xn = make<xnode>(prev, ppos, cur, hash, level);
+            // once published, xn may be completed and retired by anyone
+            hazard_pointer hx;
+            hx.set(xn);
+            node_ptr expected{cur};
+            if (!prev->values[ppos].compare_exchange_strong(expected, node_ptr{xn})) {
+                dispose(xn);
+                return;
+            }
+            if (!complete_compression(node_ptr{xn}))
+                return;
+            depth -= 1;
+            level -= 4;
+        }
+        if (depth > 0 || !r || r == p.nodes[0] || !sparse(p.nodes[0], level))
+            return;
+        path q;
+        q.nodes[0] = r;
+        for (auto l = 0; l < level; l += 4) {
+            auto cur = q.nodes[depth];
+            auto u = q.protect(depth, cur->values[(hash >> l) & (cur->values.size() - 1)]);
+            if (u.type() != node::anode || node_cast<anode>(u)->gen != r->gen)
+                return;
+            q.nodes[++depth] = node_cast<anode>(u);
+        }
+        compress(hash, level, q, depth, nullptr);
+    }
+
+    // an anode at level is sparse if its live slots hold nothing but leaves,
+    // at most one of them, or no two in the same slot of a narrow anode if
+    // it is wide. the tags tell most anodes apart, only the hashes of a few
+    // leaves are read. the caller protects cur.
+    static auto sparse(anode* cur, int level) -> bool
+    {
+        auto live = 0;
+        for (auto& slot : cur->values) {
+            auto u = slot.load();
+            if (u && u.type() != node::snode && u.type() != node::lnode)
+                return false;
+            live += u ? 1 : 0;
+        }
+        if (live <= 1)
+            return true;
+        if (cur->values.size() == 4 || live > 4)
+            return false;
+        hazard_pointer hp;
+        unsigned taken = 0;
+        for (auto& slot : cur->values) {
+            auto u = hp.protect(slot);
+            if (!u)
+                continue;
+            if (u.type() != node::snode && u.type() != node::lnode)
+                return false;
+            auto bit = 1u << ((leaf_hash(u) >> level) & 3);
+            if (taken & bit)
+                return false;
+            taken |= bit;
+        }
+        return true;
+    }
+
+    auto remove(key_type const& key) -> std::optional<value_type>
     {
-        auto type() const -> node override { return node::notxn; }
-    };
+        return remove(key, hash(key));
+    }
 
-    struct snode : base_node
+    auto remove(key_type const& key, hash_type hash) -> std::optional<value_type>
     {
-        snode(hash_type hash, key_type const& key, value_type const& value)
-            : hash(hash), key(key), value(value), txn(std::make_shared<notxn>()) {}
+        guard g;
+        announcement a;
+        while (true) {
+            hazard_pointer hr;
+            auto r = enter(a, hash, hr);
+            hazard_pointer hc, ha;
+            auto c = hc.protect(cache);
+            if (auto cur = cached(c, hash, ha); cur && cur->gen == r->gen) {
+                auto res = remove(key, hash, c->level, cur, r);
+                if (res.first)
+                    return res.second;
+            }
+            record_cache_miss();
+            auto res = remove(key, hash, 0, r, r);
+            if (res.first)
+                return res.second;
+        }
+    }
 
-        auto type() const -> node override { return node::snode; }
+    // a traversal that may run alongside updates. it visits every key that
+    // is in the trie for all of it exactly once, and a key inserted or
+    // removed meanwhile at most once, with any value the key had meanwhile.
+    // a key has one place along its hash, which the traversal passes once:
+    // it reads each slot in place and goes on below a node that is frozen
+    // and replaced afterwards, whose slots keep what was there when it
+    // froze. nothing is allocated per key. with epoch the guard of a
+    // traversal holds back every node retired while it runs.
+    auto begin() const { return iterator{root}; }
 
-        hash_type hash;
-        key_type key;
-        value_type value;
-        std::shared_ptr<base_node> txn;
-    };
+    auto end() const { return typename iterator::sentinel{}; }
 
-    // TODO narrow (4) or wide (16) array. we can maintain an extra counter to
-    // count non empty node.
-    struct anode : base_node
+    template <class F>
+    void for_each(F&& fn) const
     {
-        anode(int size) : values(size) {}
+        for (auto it = begin(); it != end(); ++it)
+            fn(it.key(), it.value());
+    }
 
-        auto type() const -> node override { return node::anode; }
+    // every node below root, depth first like the iterator and as safe
+    // alongside updates, as fn(u, from, pos, depth): u was read from slot pos
+    // of the anode from at depth, root at 0. root itself comes first, from
+    // nothing at depth -1, and the frozen node an enode or xnode replaces
+    // right after it, from the enode or xnode at its depth.
+    template <class F>
+    static void walk(anode* root, F&& fn)
+    {
+        path p;
+        int pos[path::max_depth];
+        auto depth = 0;
+        p.nodes[0] = root;
+        pos[0] = 0;
+        fn(node_ptr{root}, nullptr, 0, -1);
+        while (depth >= 0) {
+            auto cur = p.nodes[depth];
+            if (pos[depth] == static_cast<int>(cur->values.size())) {
+                if (--depth >= 0)
+                    pos[depth] += 1;
+                continue;
+            }
+            auto u = p.protect(depth, cur->values[pos[depth]]);
+            fn(u, static_cast<void const*>(cur), pos[depth], depth);
+            anode* next = nullptr;
+            if (u.type() == node::anode || u.type() == node::fnode) {
+                next = node_cast<anode>(u);
+            } else if (u.type() == node::enode) {
+                next = node_cast<enode>(u)->narrow;
+                fn(node_ptr{next}, u.address(), 0, depth);
+            } else if (u.type() == node::xnode) {
+                next = node_cast<xnode>(u)->stale;
+                fn(node_ptr{next}, u.address(), 0, depth);
+            }
+            if (next) {
+                p.nodes[++depth] = next;
+                pos[depth] = 0;
+            } else {
+                pos[depth] += 1;
+            }
+        }
+    }
 
-        std::vector<std::shared_ptr<base_node>> values;
-    };
+    enum stats_kind { anode_4, anode_16, fnode_4, fnode_16, snode_kind, lnode_kind,
+        flnode_kind, enode_kind, xnode_kind, fvnode_kind, cache_kind };
 
-    struct fsnode : base_node
+    // the shape of the trie and what it takes, see util::trie_stats. it
+    // walks the trie like for_each and may run alongside updates, so the
+    // counts are of no single moment then. pending counts the nodes retired
+    // by all tries of the reclaimer and not yet freed, and those buried in
+    // the cache. an anode shared with a snapshot counts in full for both.
+    auto stats() const -> util::trie_stats
     {
-        auto type() const -> node override { return node::fsnode; }
-    };
+        guard g;
+        hazard_pointer hr;
+        hazard_pointer hc;
+        auto s = stats(hr.protect(root), hc.protect(cache));
+        s.pending += reclaimer::retired_count();
+        return s;
+    }
 
-    struct fvnode : base_node
+    static auto stats(anode* root, cache_node* c) -> util::trie_stats
     {
-        auto type() const -> node override { return node::fvnode; }
-    };
+        util::trie_stats s{"anode-4", "anode-16", "fnode-4", "fnode-16", "snode", "lnode",
+            "flnode", "enode", "xnode", "fvnode", "cache"};
+        walk(root, [&](node_ptr u, void const*, int, int depth) {
+            switch (u.type()) {
+            case node::anode:
+            case node::fnode: {
+                auto an = node_cast<anode>(u);
+                auto n = static_cast<int>(an->values.size());
+                auto used = 0;
+                for (auto& slot : an->values) {
+                    auto v = slot.load(std::memory_order_relaxed);
+                    used += v && v.type() != node::fvnode;
+                }
+                auto k = u.type() == node::anode ? anode_4 : fnode_4;
+                s.add(n == 4 ? k : k + 1, anode::bytes(n));
+                s.slots(n, used);
+                break;
+            }
+            case node::snode:
+                s.add(snode_kind, sizeof(snode));
+                s.leaf(depth, 1);
+                break;
+            case node::lnode:
+            case node::flnode: {
+                auto ln = node_cast<lnode>(u);
+                auto size = sizeof(lnode);
+                for (auto b = ln->entries.next; b; b = b->next)
+                    size += sizeof(*b);
+                s.add(u.type() == node::lnode ? lnode_kind : flnode_kind, size);
+                s.leaf(depth, ln->entries.count());
+                break;
+            }
+            case node::enode:
+                s.add(enode_kind, sizeof(enode));
+                break;
+            case node::xnode:
+                s.add(xnode_kind, sizeof(xnode));
+                break;
+            case node::fvnode:
+                s.add(fvnode_kind, 0);
+                break;
+            default:
+                break;
+            }
+        });
+        if (c) {
+            s.add(cache_kind, sizeof(cache_node) + c->values.size() * sizeof(std::atomic<anode*>));
+            s.pending += c->graveyard_size.load(std::memory_order_relaxed);
+        }
+        return s;
+    }
 
-    struct fnode : base_node
+    // the trie as a dot graph, written as it is walked, see walk. markers
+    // and empty slots are left out.
+    void write_dot(std::ostream& os) const
     {
-        fnode(std::shared_ptr<anode> const& an)
-            : frozen(an) {}
+        guard g;
+        hazard_pointer hr;
+        write_dot(os, hr.protect(root));
+    }
 
-        auto type() const -> node override { return node::fnode; }
+    static void write_dot(std::ostream& os, anode* root)
+    {
+        util::dot_writer dot{os};
+        walk(root, [&](node_ptr u, void const* from, int pos, int) {
+            auto id = u.address();
+            if (u.type() == node::anode || u.type() == node::fnode) {
+                dot.node(id, u.type(), ", size=", node_cast<anode>(u)->values.size());
+            } else if (u.type() == node::snode) {
+                dot.node(id, "snode, value=", load(node_cast<snode>(u)));
+            } else if (u.type() == node::lnode || u.type() == node::flnode) {
+                dot.node(id, u.type(), ", size=", node_cast<lnode>(u)->entries.count());
+            } else if (u.type() == node::enode || u.type() == node::xnode) {
+                dot.node(id, u.type());
+            } else {
+                return;
+            }
+            if (from)
+                dot.edge(from, id, pos);
+        });
+    }
 
-        std::shared_ptr<anode> frozen;
-    };
+    // the trie as it is now as an image file, through a snapshot, see
+    // view::save
+    auto save(std::string const& path) -> bool
+    {
+        return snapshot().save(path);
+    }
 
-    struct enode : base_node
+    // the frozen subtree of an in an image, children first. an enode or
+    // xnode stands for the frozen node it replaces, like in the iterator.
+    // anodes left empty are not written, 0 is returned instead.
+    template <class Writer>
+    static auto save(Writer& w, anode* an) -> std::uint64_t
     {
-        enode(
-            std::shared_ptr<anode> const& parent,
-            int parent_pos,
-            std::shared_ptr<anode> const& narrow,
-            hash_type hash,
-            int level
-        ) : parent(parent), parent_pos(parent_pos), narrow(narrow), hash(hash), level(level)
-        {
+        std::uint64_t slots[16] = {};
+        auto used = false;
+        for (auto i = 0u; i < an->values.size(); i++) {
+            auto u = an->values[i].load();
+            switch (u.type()) {
+            case node::snode: {
+                auto sn = node_cast<snode>(u);
+                slots[i] = w.leaf(sn->hash, sn->key, load(sn));
+                break;
+            }
+            case node::lnode:
+            case node::flnode: {
+                auto ln = node_cast<lnode>(u);
+                slots[i] = w.bucket(ln->hash, ln->entries);
+                break;
+            }
+            case node::anode:
+            case node::fnode:
+                slots[i] = save(w, node_cast<anode>(u));
+                break;
+            case node::enode:
+                slots[i] = save(w, node_cast<enode>(u)->narrow);
+                break;
+            case node::xnode:
+                slots[i] = save(w, node_cast<xnode>(u)->stale);
+                break;
+            default:
+                break;
+            }
+            used |= slots[i] != 0;
         }
+        return used ? w.anode(slots, an->values.size()) : 0;
+    }
 
-        auto type() const -> node override { return node::enode; }
-
-        std::shared_ptr<anode> parent;
-        int parent_pos;
-        std::shared_ptr<anode> narrow;
-        hash_type hash;
-        std::shared_ptr<anode> wide;
-        int level;
-    };
+    static constexpr std::size_t progress_units = 1 << 12;
 
-    struct xnode : base_node
+    // the trie in an image, children first, walked like walk while updates
+    // go on rather than through a snapshot, so no update copies a path for
+    // it. it is as consistent as for_each: a key that is not updated
+    // meanwhile is written with its value, one that is may be written with
+    // either value or be left out. progress(n) is called whenever n of
+    // progress_units of the hash space are done. the walk holds a guard
+    // throughout, with epoch nothing retired meanwhile is freed before it
+    // ends.
+    template <class Writer, class F>
+    auto stream(Writer& w, F&& progress) -> std::uint64_t
     {
-        xnode(
-            std::shared_ptr<anode> const& parent,
-            int parent_pos,
-            std::shared_ptr<anode> const& stale,
-            hash_type hash,
-            int level
-        ) : parent(parent), parent_pos(parent_pos), stale(stale), hash(hash), level(level)
-        {
+        guard g;
+        hazard_pointer hr;
+        path p;
+        int pos[path::max_depth];
+        std::uint64_t slots[path::max_depth][16];
+        // the progress units of a slot at every depth, 0 below some depth
+        std::size_t unit[path::max_depth];
+        auto depth = 0;
+        p.nodes[0] = hr.protect(root);
+        pos[0] = 0;
+        unit[0] = progress_units / p.nodes[0]->values.size();
+        while (true) {
+            auto cur = p.nodes[depth];
+            auto n = cur->values.size();
+            if (pos[depth] == static_cast<int>(n)) {
+                auto used = std::any_of(slots[depth], slots[depth] + n, [](auto u) { return u != 0; });
+                auto ref = used || depth == 0 ? w.anode(slots[depth], n) : 0;
+                if (depth-- == 0) {
+                    progress(progress_units);
+                    return ref;
+                }
+                slots[depth][pos[depth]] = ref;
+                if (unit[depth]) {
+                    std::size_t done = 0;
+                    for (auto d = 0; d <= depth; d++)
+                        done += (pos[d] + (d == depth)) * unit[d];
+                    progress(done);
+                }
+                pos[depth] += 1;
+                continue;
+            }
+            auto u = p.protect(depth, cur->values[pos[depth]]);
+            auto& slot = slots[depth][pos[depth]];
+            slot = 0;
+            anode* next = nullptr;
+            switch (u.type()) {
+            case node::snode: {
+                auto sn = node_cast<snode>(u);
+                slot = w.leaf(sn->hash, sn->key, load(sn));
+                break;
+            }
+            case node::lnode:
+            case node::flnode: {
+                auto ln = node_cast<lnode>(u);
+                slot = w.bucket(ln->hash, ln->entries);
+                break;
+            }
+            case node::anode:
+            case node::fnode:
+                next = node_cast<anode>(u);
+                break;
+            case node::enode:
+                next = node_cast<enode>(u)->narrow;
+                break;
+            case node::xnode:
+                next = node_cast<xnode>(u)->stale;
+                break;
+            default:
+                break;
+            }
+            if (next) {
+                unit[depth + 1] = unit[depth] / next->values.size();
+                p.nodes[++depth] = next;
+                pos[depth] = 0;
+            } else {
+                pos[depth] += 1;
+            }
         }
+    }
 
-        auto type() const -> node override { return node::xnode; }
-
-        std::shared_ptr<anode> parent;
-        int parent_pos;
-        std::shared_ptr<anode> stale;
-        hash_type hash;
-        int level;
-    };
-
-
-    auto lookup(
-        key_type const& key,
-        hash_type hash,
-        int level,
-        std::shared_ptr<anode> const& cur
-    ) -> std::optional<value_type>
+    // the node at ref of image as a new node of generation gen
+    template <class Image>
+    static auto thaw(Image const& image, std::uint64_t ref, std::uint64_t gen) -> node_ptr
     {
-        auto pos = (hash >> level) & ((cur->values).size() - 1);
-        auto old = std::atomic_load(&cur->values[pos]);
-        if (!old || old->type() == node::fvnode) {
+        switch (util::image::kind_of(ref)) {
+        case util::image::leaf_kind: {
+            auto l = image.template node<typename Image::leaf>(ref);
+            return node_ptr{make<snode>(l->hash, l->key, l->value)};
+        }
+        case util::image::bucket_kind: {
+            auto b = image.template node<typename Image::bucket>(ref);
+            auto ln = make<lnode>(b->hash);
+            for (auto i = 0u; i < b->count; i++)
+                ln->entries.assign(b->keys()[i], b->values()[i]);
+            return node_ptr{ln};
+        }
+        case util::image::anode_kind: {
+            auto src = image.template node<typename Image::anode>(ref);
+            auto an = make_anode(static_cast<int>(src->size), gen);
+            for (auto i = 0u; i < src->size; i++)
+                an->values[i].store(thaw(image, src->slots()[i], gen), std::memory_order_relaxed);
+            return node_ptr{an};
+        }
+        default:
             return {};
-        } else if (old->type() == node::anode) {
-            auto oldan = std::static_pointer_cast<anode>(old);
-            return lookup(key, hash, level + 4, oldan);
-        } else if (old->type() == node::snode) {
-            auto oldsn = std::static_pointer_cast<snode>(old);
-            if (oldsn->key == key)
-                return oldsn->value;
-            else
-                return {};
-        } else if (old->type() == node::enode) {
-            auto olden = std::static_pointer_cast<enode>(old);
-            return lookup(key, hash, level + 4, olden->narrow);
-        } else if (old->type() == node::fnode) {
-            auto oldfn = std::static_pointer_cast<fnode>(old);
-            return lookup(key, hash, level + 4, oldfn->frozen);
         }
-
-        // else {
-        //     // TODO throw error, unexpected case
-        // }
-
-        return {};
     }
 
-    auto insert(
-        key_type const& key,
-        value_type const& value,
-        hash_type hash,
-        int level,
-        std::shared_ptr<anode> const& cur,
-        std::shared_ptr<anode> const& prev
-    ) -> bool
-    {
-        // std::cerr << "inserting: hash=" << hash << ", level=" << level << "\n";
-        auto pos = (hash >> level) & ((cur->values).size() - 1);
-        auto old = std::atomic_load(&cur->values[pos]);
-        if (!old) {
-            std::shared_ptr<base_node> sn{std::make_shared<snode>(hash, key, value)};
-            if (std::atomic_compare_exchange_weak(&cur->values[pos], &old, sn))
-                return true;
-            else
-                return insert(key, value, hash, level, cur, prev);
-        } else if (old->type() == node::anode) {
-            auto an = std::static_pointer_cast<anode>(old);
-            return insert(key, value, hash, level + 4, an, cur);
-        } else if (old->type() == node::snode) {
-            auto u = std::static_pointer_cast<snode>(old);
-            auto txn = std::atomic_load(&u->txn);
-            if (txn->type() == node::notxn) {
-                if (u->key == key) {
-                    std::shared_ptr<base_node> sn{std::make_shared<snode>(hash, key, value)};
-                    if (std::atomic_compare_exchange_weak(&u->txn, &txn, sn)) {
-                        std::atomic_compare_exchange_weak(&cur->values[pos], &old, sn);
-                        return true;
-                    } else {
-                        return insert(key, value, hash, level, cur, prev);
-                    }
-                } else if (cur->values.size() == 4) {
-                    auto ppos = (hash >> (level - 4)) & (prev->values.size() - 1);
-                    std::shared_ptr<base_node> en{std::make_shared<enode>(prev, ppos, cur, hash, level)};
-                    auto uen = std::static_pointer_cast<enode>(en);
-                    auto bcur = std::static_pointer_cast<base_node>(cur);
-                    if (std::atomic_compare_exchange_weak(&prev->values[ppos], &bcur, en)) {
-                        // TODO atomic_load en?
-                        complete_expansion(en);
-                        auto wide = std::atomic_load(&uen->wide);
-                        return insert(key, value, hash, level, wide, prev);
-                    } else {
-                        return insert(key, value, hash, level, cur, prev);
-                    }
-                } else {
-                    auto an = create_anode(
-                        u->hash, u->key, u->value,
-                        hash, key, value,
-                        level + 4
-                    );
-                    if (std::atomic_compare_exchange_weak(&u->txn, &txn, an)) {
-                        std::atomic_compare_exchange_weak(&cur->values[pos], &old, an);
-                        return true;
-                    } else {
-                        return insert(key, value, hash, level, cur, prev);
-                    }
+    // a read only view of the trie as it is now, in constant time, in the
+    // manner of the snapshots of Ctries. the root is frozen and a copy of a
+    // new generation takes its place. updates copy every anode of an older
+    // generation they pass before they write below it, so the snapshot keeps
+    // the old ones to itself, and a write pays for the path it copies.
+    // updates that started from the old root before it was frozen may still
+    // write below it, the snapshot takes effect once their paths are frozen
+    // too, see settle.
+    auto snapshot() -> view
+    {
+        guard g;
+        while (true) {
+            hazard_pointer hr;
+            auto r = hr.protect(root);
+            anode* expected = nullptr;
+            if (unsettled.compare_exchange_strong(expected, r)) {
+                if (root.load() == r) {
+                    settle(r);
+                    return view{r, hash_function};
                 }
-            } else if (txn->type() == node::fsnode) {
-                return false;
+                // another snapshot swapped the root in the meantime
+                unsettled.compare_exchange_strong(r, nullptr);
             } else {
-                std::atomic_compare_exchange_weak(&cur->values[pos], &old, txn);
-                return insert(key, value, hash, level, cur, prev);
+                hazard_pointer hs;
+                if (auto s = hs.protect(unsettled))
+                    settle(s);
             }
-        } else if (old->type() == node::enode) {
-            complete_expansion(old);
         }
-        return false;
     }
 
-    void insert(key_type const& key, value_type const& value, hash_type hash)
+    // publishes the root an update starts from and returns it, after helping
+    // the snapshot being taken, if any. an update that published old before
+    // settle(old) read the records has its path frozen by it, one that
+    // published later finds unsettled set.
+    auto enter(announcement& a, hash_type hash, hazard_pointer& hr) -> anode*
     {
-        if (!insert(key, value, hash, 0, std::atomic_load(&root), nullptr))
-            insert(key, value, hash);
+        a.rec.hash.store(hash, std::memory_order_relaxed);
+        while (true) {
+            auto r = hr.protect(root);
+            a.rec.root.store(r);
+            hazard_pointer hs;
+            if (auto s = hs.protect(unsettled))
+                settle(s);
+            else if (root.load() == r)
+                return r;
+        }
     }
 
-    auto remove(
-        key_type const& key,
-        hash_type hash,
-        int level,
-        std::shared_ptr<anode> const& cur,
-        std::shared_ptr<anode> const& prev
-    ) -> std::pair<bool, std::optional<value_type>>
+    // completes the snapshot of old: freezes it, swaps a copy of a new
+    // generation in as root, and freezes the path of every update that
+    // started from old, so that nothing below old changes any more. updates
+    // help with it before they start, so every step may be repeated.
+    void settle(anode* old)
     {
-        auto mask = (cur->values.size()) - 1;
-        auto pos = (hash >> level) & mask;
-        auto old = std::atomic_load(&cur->values[pos]);
-        if (!old) {
-            return {true, {}};
-        } else if (old->type() == node::anode) {
-            auto oldan = std::static_pointer_cast<anode>(old);
-            return remove(key, hash, level + 4, oldan, cur);
-        } else if (old->type() == node::snode) {
-            auto oldsn = std::static_pointer_cast<snode>(old);
-            auto txn = std::atomic_load(&oldsn->txn);
-            if (txn->type() == node::notxn) {
-                if (oldsn->hash == hash && oldsn->key == key) {
-                    std::shared_ptr<base_node> empty{nullptr};
-                    if (std::atomic_compare_exchange_weak(&oldsn->txn, &txn, empty)) {
-                        std::atomic_compare_exchange_weak(&cur->values[pos], &old, empty);
-                        return {true, oldsn->value};
-                    } else {
-                        return remove(key, hash, level, cur, prev);
-                    }
-                } else {
-                    return {true, {}};
-                }
-            } else if (txn->type() == node::fsnode) {
-                return {false, {}};
-            } else {
-                std::atomic_compare_exchange_weak(&cur->values[pos], &old, txn);
-                return remove(key, hash, level, cur, prev);
-            }
-        } else if (old->type() == node::enode) {
-            complete_expansion(old);
-            return {false, {}};
-        } else if (old->type() == node::xnode) {
-            complete_compression(old);
-            return {false, {}};
-        } else if (old->type() == node::fnode || old->type() == node::fvnode) {
-            return {false, {}};
+        freeze(old, false);
+        if (root.load() == old) {
+            auto nu = copy(old, new_generation());
+            auto expected = old;
+            if (!root.compare_exchange_strong(expected, nu))
+                destroy(node_ptr{nu});
         }
+        for (auto r = announcement::records::records.load(); r; r = r->next)
+            if (r->root.load() == old)
+                freeze_path(old, r->hash.load(std::memory_order_relaxed));
+        unsettled.compare_exchange_strong(old, nullptr);
+    }
 
-        // else {
-        //     // TODO throw error, unexpected case
-        // }
-
-        return {false, {}};
+    // freezes the anodes along hash below the frozen cur, all an update that
+    // started from it could still write to.
+    void freeze_path(anode* cur, hash_type hash)
+    {
+        for (auto level = 0; ; level += 4) {
+            auto pos = (hash >> level) & (cur->values.size() - 1);
+            auto u = cur->values[pos].load();
+            if (u.type() != node::fnode)
+                return;
+            cur = node_cast<anode>(u);
+            freeze(cur, false);
+        }
     }
 
-    auto remove(key_type const& key, hash_type hash) -> std::optional<value_type>
+    // replaces the anode of an older generation in slot by a copy of
+    // generation gen. the anode is frozen first, since a snapshot may share
+    // it and the cache must not trust it any more.
+    void renew(std::atomic<node_ptr>& slot, node_ptr old, std::uint64_t gen)
     {
-        auto res = remove(key, hash, 0, std::atomic_load(&root), nullptr);
-        if (res.first)
-            return res.second;
+        auto an = node_cast<anode>(old);
+        freeze(an, false);
+        auto nu = copy(an, gen);
+        if (slot.compare_exchange_strong(old, node_ptr{nu}))
+            retire_unlinked(an, unref);
         else
-            return remove(key, hash);
+            destroy(node_ptr{nu});
+    }
+
+    // a new anode of generation gen with the contents of the frozen an. the
+    // leaves are copied, the anodes below are shared.
+    static auto copy(anode* an, std::uint64_t gen) -> anode*
+    {
+        auto nu = make_anode(static_cast<int>(an->values.size()), gen);
+        for (auto i = 0u; i < an->values.size(); i++) {
+            auto u = an->values[i].load();
+            node_ptr v;
+            if (u.type() == node::snode) {
+                auto sn = node_cast<snode>(u);
+                v = node_ptr{make<snode>(sn->hash, sn->key, sn->value)};
+            } else if (u.type() == node::flnode) {
+                v = node_ptr{make<lnode>(*node_cast<lnode>(u))};
+            } else if (u.type() == node::fnode) {
+                node_cast<anode>(u)->refs.fetch_add(1, std::memory_order_relaxed);
+                v = node_ptr{u.address(), node::anode};
+            }
+            nu->values[i].store(v, std::memory_order_relaxed);
+        }
+        return nu;
+    }
+
+    // generations are unique over all tries of a type, so that a trie made
+    // from a view tells its own anodes from those of the trie it shares with.
+    static auto new_generation() -> std::uint64_t
+    {
+        static std::atomic<std::uint64_t> generations{0};
+        return generations.fetch_add(1) + 1;
     }
 
+    // the sequential_* helpers build nodes that are not published yet, so
+    // they use relaxed accesses, the CAS that publishes them orders them.
+    // leaves are snodes or lnodes.
     void sequential_insert(
-        std::shared_ptr<snode> const& sn,
-        std::shared_ptr<anode> const& wide,
+        node_ptr leaf,
+        anode* wide,
         int level
     )
     {
         // FIXME later, the naming of wide
         auto mask = wide->values.size() - 1;
-        auto pos = (sn->hash >> level) & mask;
-        if (!wide->values[pos])
-            wide->values[pos] = sn;
+        auto pos = (leaf_hash(leaf) >> level) & mask;
+        if (!wide->values[pos].load(std::memory_order_relaxed))
+            wide->values[pos].store(leaf, std::memory_order_relaxed);
         else
-            sequential_insert(sn, wide, level, pos);
+            sequential_insert(leaf, wide, level, pos);
     }
 
     void sequential_insert(
-        std::shared_ptr<snode> const& sn,
-        std::shared_ptr<anode> const& wide,
+        node_ptr leaf,
+        anode* wide,
         int level,
         int pos
     )
     {
-        auto old = wide->values[pos];
-        if (old->type() == node::snode) {
-            auto oldsn = std::static_pointer_cast<snode>(old);
-            auto an = create_anode(sn, oldsn, level + 4);
-            wide->values[pos] = an;
-        } else if (old->type() == node::anode) {
-            auto oldan = std::static_pointer_cast<anode>(old);
+        auto old = wide->values[pos].load(std::memory_order_relaxed);
+        if (old.type() == node::snode || old.type() == node::lnode) {
+            auto an = create_anode(leaf, old, level + 4, wide->gen);
+            wide->values[pos].store(an, std::memory_order_relaxed);
+        } else if (old.type() == node::anode) {
+            auto oldan = node_cast<anode>(old);
             auto mask = oldan->values.size() - 1;
-            auto npos = (sn->hash >> (level + 4)) & mask;
-            if (!oldan->values[npos]) {
-                oldan->values[npos] = sn;
+            auto npos = (leaf_hash(leaf) >> (level + 4)) & mask;
+            if (!oldan->values[npos].load(std::memory_order_relaxed)) {
+                oldan->values[npos].store(leaf, std::memory_order_relaxed);
             } else if (oldan->values.size() == 4) {
-                std::shared_ptr<base_node> an{std::make_shared<anode>(16)};
-                auto uan = std::static_pointer_cast<anode>(an);
-                sequential_transfer(oldan, uan, level + 4);
-                wide->values[pos] = an;
-                sequential_insert(sn, wide, level, pos);
+                auto an = make_anode(16, wide->gen);
+                sequential_transfer(oldan, an, level + 4);
+                wide->values[pos].store(node_ptr{an}, std::memory_order_relaxed);
+                dispose(oldan);
+                sequential_insert(leaf, wide, level, pos);
             } else {
-                sequential_insert(sn, oldan, level + 4, npos);
+                sequential_insert(leaf, oldan, level + 4, npos);
             }
         }
     }
 
+    // copies the frozen source into wide, the source keeps its own nodes and
+    // is retired as a whole by retire_unlinked. the unpublished narrow nodes
+    // sequential_insert expands are not frozen, their nodes are moved.
     void sequential_transfer(
-        std::shared_ptr<anode> const& source,
-        std::shared_ptr<anode> const& wide,
+        anode* source,
+        anode* wide,
         int level
     )
     {
         auto mask = wide->values.size() - 1;
-        auto i = 0;
+        auto i = 0u;
         while (i < source->values.size()) {
-            auto _node = source->values[i];
-            // TODO we leave lnode here (for same key)
-            if (_node->type() == node::fvnode) {
+            auto _node = source->values[i].load();
+            node_ptr leaf;
+            if (!_node || _node.type() == node::fvnode) {
             } else if (is_frozen_snode(_node)) {
-                auto oldsn = std::static_pointer_cast<snode>(_node);
-                std::shared_ptr<base_node> sn{std::make_shared<snode>(
+                auto oldsn = node_cast<snode>(_node);
+                leaf = node_ptr{make<snode>(
                     oldsn->hash,
                     oldsn->key,
                     oldsn->value
                 )};
-                auto usn = std::static_pointer_cast<snode>(sn);
-                auto pos = (usn->hash >> level) & mask;
-                if (!wide->values[pos])
-                    wide->values[pos] = sn;
-                else
-                    sequential_insert(usn, wide, level, pos);
-            } else if (_node->type() == node::fnode) {
-                auto fn = std::static_pointer_cast<fnode>(_node);
-                auto an = std::static_pointer_cast<anode>(fn->frozen);
-                sequential_transfer(an, wide, level);
+            } else if (_node.type() == node::flnode) {
+                leaf = node_ptr{make<lnode>(*node_cast<lnode>(_node))};
+            } else if (_node.type() == node::snode || _node.type() == node::lnode) {
+                leaf = _node;
+            } else if (_node.type() == node::fnode) {
+                sequential_transfer(node_cast<anode>(_node), wide, level);
             } else {
                 // TODO throw an error, source array node should have been
                 // frozen.
             }
+            if (leaf) {
+                auto pos = (leaf_hash(leaf) >> level) & mask;
+                if (!wide->values[pos].load(std::memory_order_relaxed))
+                    wide->values[pos].store(leaf, std::memory_order_relaxed);
+                else
+                    sequential_insert(leaf, wide, level, pos);
+            }
             i += 1;
         }
     }
 
     void sequential_transfer_narrow(
-        std::shared_ptr<anode> const& source,
-        std::shared_ptr<anode> const& narrow
+        anode* source,
+        anode* narrow
     )
     {
         auto i = 0;
         while (i < 4) {
-            auto _node = source->values[i];
-            if (_node->type() == node::fvnode) {
+            auto _node = source->values[i].load();
+            if (_node.type() == node::fvnode) {
             } else if (is_frozen_snode(_node)) {
-                auto oldsn = std::static_pointer_cast<snode>(_node);
-                std::shared_ptr<base_node> sn{std::make_shared<snode>(
+                auto oldsn = node_cast<snode>(_node);
+                auto sn = make<snode>(
                     oldsn->hash,
                     oldsn->key,
                     oldsn->value
-                )};
-                narrow->values[i] = sn;
+                );
+                narrow->values[i].store(node_ptr{sn}, std::memory_order_relaxed);
+            } else if (_node.type() == node::flnode) {
+                auto ln = make<lnode>(*node_cast<lnode>(_node));
+                narrow->values[i].store(node_ptr{ln}, std::memory_order_relaxed);
             } else {
                 // TODO throw an error, source array node should have been
                 // frozen.
@@ -427,193 +1938,245 @@ struct trie
         }
     }
 
-    auto is_frozen_snode(std::shared_ptr<base_node> const& node)
+    static auto is_frozen_snode(node_ptr u)
     {
-        if (node->type() == node::snode) {
-            auto sn = std::static_pointer_cast<snode>(node);
-            auto txn = std::atomic_load(&sn->txn);
-            return txn->type() == node::fsnode;
-        } else {
-            return false;
-        }
+        return u.type() == node::snode
+            && node_cast<snode>(u)->txn.load().type() == node::fsnode;
+    }
+
+    static auto leaf_hash(node_ptr u) -> hash_type
+    {
+        if (u.type() == node::snode)
+            return node_cast<snode>(u)->hash;
+        return node_cast<lnode>(u)->hash;
+    }
+
+    static auto find(
+        lnode* ln,
+        key_type const& key,
+        hash_type hash
+    ) -> std::optional<value_type>
+    {
+        if (ln->hash == hash)
+            if (auto v = ln->entries.find(key))
+                return *v;
+        return {};
     }
 
-    // create fresh snode
+    // create fresh snode, or an lnode for keys of the same hash
     auto create_anode(
         hash_type h1, key_type const& k1, value_type const& v1,
         hash_type h2, key_type const& k2, value_type const& v2,
-        int level
-    ) -> std::shared_ptr<base_node>
+        int level,
+        std::uint64_t gen
+    ) -> node_ptr
     {
+        if (h1 == h2) {
+            auto ln = make<lnode>(h1);
+            ln->entries.assign(k1, v1);
+            ln->entries.assign(k2, v2);
+            return node_ptr{ln};
+        }
         return create_anode(
-            std::make_shared<snode>(h1, k1, v1),
-            std::make_shared<snode>(h2, k2, v2),
-            level
+            node_ptr{make<snode>(h1, k1, v1)},
+            node_ptr{make<snode>(h2, k2, v2)},
+            level, gen
         );
     }
 
     // TODO is it sequential?
+    // the leaves never share a hash, keys of the same hash share an lnode.
     auto create_anode(
-        std::shared_ptr<base_node> const& sn1,
-        std::shared_ptr<base_node> const& sn2,
-        int level
-    ) -> std::shared_ptr<base_node>
-    {
-        auto usn1 = std::static_pointer_cast<snode>(sn1);
-        auto usn2 = std::static_pointer_cast<snode>(sn2);
-        auto hash1 = usn1->hash;
-        auto hash2 = usn2->hash;
-        if (hash1 == hash2) {
-            // TODO not dealing with same hash yet
-            // TODO throw error now
-            return {};
+        node_ptr sn1,
+        node_ptr sn2,
+        int level,
+        std::uint64_t gen
+    ) -> node_ptr
+    {
+        auto hash1 = leaf_hash(sn1);
+        auto hash2 = leaf_hash(sn2);
+        auto pos1 = (hash1 >> level) & (4 - 1);
+        auto pos2 = (hash2 >> level) & (4 - 1);
+        if (pos1 != pos2) {
+            auto an = make_anode(4, gen);
+            an->values[pos1].store(sn1, std::memory_order_relaxed);
+            an->values[pos2].store(sn2, std::memory_order_relaxed);
+            return node_ptr{an};
         } else {
-            auto pos1 = (hash1 >> level) & (4 - 1);
-            auto pos2 = (hash2 >> level) & (4 - 1);
-            if (pos1 != pos2) {
-                std::shared_ptr<base_node> an{std::make_shared<anode>(4)};
-                auto uan = std::static_pointer_cast<anode>(an);
-                uan->values[pos1] = sn1;
-                uan->values[pos2] = sn2;
-                return an;
-            } else {
-                std::shared_ptr<base_node> an{std::make_shared<anode>(16)};
-                auto uan = std::static_pointer_cast<anode>(an);
-                sequential_insert(std::static_pointer_cast<snode>(sn1), uan, level);
-                sequential_insert(std::static_pointer_cast<snode>(sn2), uan, level);
-                return an;
-            }
+            auto an = make_anode(16, gen);
+            sequential_insert(sn1, an, level);
+            sequential_insert(sn2, an, level);
+            return node_ptr{an};
         }
     }
 
-    void complete_expansion(std::shared_ptr<base_node> const& u)
+    // the caller protects u, the frozen narrow node is retired after en.
+    void complete_expansion(node_ptr u)
     {
-        auto en = std::static_pointer_cast<enode>(u);
-        freeze(std::atomic_load(&en->narrow));
-        std::shared_ptr<base_node> wide{std::make_shared<anode>(16)};
-        auto awide = std::static_pointer_cast<anode>(wide);
-        sequential_transfer(std::atomic_load(&en->narrow), awide, en->level);
-        std::shared_ptr<anode> empty;
-        // TODO maybe create the dereived first for better performance
-        if (!std::atomic_compare_exchange_weak(&en->wide, &empty, awide))
-            // FIXME ?
-            wide = std::atomic_load(&en->wide);
-        std::atomic_compare_exchange_weak(&en->parent->values[en->parent_pos], &u, wide);
+        auto en = node_cast<enode>(u);
+        freeze(en->narrow);
+        auto wide = en->wide.load();
+        if (!wide) {
+            auto an = make_anode(16, en->parent->gen);
+            sequential_transfer(en->narrow, an, en->level);
+            if (en->wide.compare_exchange_strong(wide, an))
+                wide = an;
+            else
+                destroy(node_ptr{an});
+        }
+        auto expected = u;
+        if (en->parent->values[en->parent_pos].compare_exchange_strong(expected, node_ptr{wide})) {
+            retire_unlinked(en, [](void* p) {
+                auto en = static_cast<enode*>(p);
+                reclaimer::retire(en->narrow, unref);
+                dispose(en);
+            }, en->level);
+        }
     }
 
-    auto complete_compression(std::shared_ptr<base_node> const& u) -> bool
+    auto complete_compression(node_ptr u) -> bool
     {
-        auto xn = std::static_pointer_cast<xnode>(u);
-        auto parent = std::atomic_load(&xn->parent);
+        auto xn = node_cast<xnode>(u);
+        auto parent = xn->parent;
         auto parent_pos = xn->parent_pos;
         auto level = xn->level;
 
-        auto stale = std::atomic_load(&xn->stale);
+        auto stale = xn->stale;
         auto compressed = freeze_and_compress(stale, level);
 
-        if (std::atomic_compare_exchange_weak(parent->values[parent_pos], u, compressed)) {
-            if (!compressed)
-                decrement_count(parent);
-            return !compressed || compressed->type() == node::snode;
+        auto expected = u;
+        if (parent->values[parent_pos].compare_exchange_strong(expected, compressed)) {
+            retire_unlinked(xn, [](void* p) {
+                auto xn = static_cast<xnode*>(p);
+                reclaimer::retire(xn->stale, unref);
+                dispose(xn);
+            }, level);
+            return !compressed || compressed.type() != node::anode;
         }
+        destroy(compressed);
         return false;
     }
 
-    void freeze(std::shared_ptr<anode> const& cur)
+    // the caller protects cur, or the head of the frozen subtree it is in.
+    // a shallow freeze turns the anodes below into fnodes but leaves their
+    // slots alone.
+    void freeze(anode* cur, bool deep = true)
     {
         auto i = 0;
-        while (i < cur->values.size()) {
-            auto _node = std::atomic_load(&cur->values[i]);
+        backoff b;
+        while (i < static_cast<int>(cur->values.size())) {
+            hazard_pointer hp;
+            auto _node = hp.protect(cur->values[i]);
             if (!_node) {
-                std::shared_ptr<base_node> fvn = std::make_shared<fvnode>();
-                if (!std::atomic_compare_exchange_weak(&cur->values[i], &_node, fvn))
+                if (!cur->values[i].compare_exchange_weak(_node, node_ptr{node::fvnode})) {
+                    b.failed();
                     i -= 1;
-            } else if (_node->type() == node::snode) {
-                auto u = std::static_pointer_cast<snode>(_node);
-                auto txn = std::atomic_load(&u->txn);
-                if (txn->type() == node::notxn) {
-                    std::shared_ptr<base_node> fsn = std::make_shared<fsnode>();
-                    if (!std::atomic_compare_exchange_weak(&u->txn, &txn, fsn))
+                }
+            } else if (_node.type() == node::snode) {
+                auto u = node_cast<snode>(_node);
+                auto txn = u->txn.load();
+                if (txn.type() == node::notxn) {
+                    if (!u->txn.compare_exchange_weak(txn, node_ptr{node::fsnode})) {
+                        b.failed();
                         i -= 1;
-                } else if (txn->type() != node::fsnode) {
+                    }
+                } else if (txn.type() != node::fsnode) {
                     // TODO not fully understood.
                     // explain: copy txn to cur[i] and do another iteration to
                     // help commit the changes first.
-                    std::atomic_compare_exchange_weak(&cur->values[i], &_node, txn);
+                    if (cur->values[i].compare_exchange_strong(_node, txn))
+                        reclaimer::retire(u, dispose_as<snode>);
+                    b.failed();
                     i -= 1;
                 }
-            } else if (_node->type() == node::anode) {
-                auto u = std::static_pointer_cast<anode>(_node);
-                std::shared_ptr<base_node> fn{std::make_shared<fnode>(u)};
-                std::atomic_compare_exchange_weak(&cur->values[i], &_node, fn);
+            } else if (_node.type() == node::anode) {
+                cur->values[i].compare_exchange_strong(_node, node_ptr{_node.address(), node::fnode});
                 i -= 1;
-            } else if (_node->type() == node::fnode) {
-                auto u = std::static_pointer_cast<fnode>(_node);
-                freeze(std::atomic_load(&u->frozen));
-            } else if (_node->type() == node::enode) {
+            } else if (_node.type() == node::lnode) {
+                if (!cur->values[i].compare_exchange_weak(_node, node_ptr{_node.address(), node::flnode})) {
+                    b.failed();
+                    i -= 1;
+                }
+            } else if (_node.type() == node::fnode) {
+                if (deep)
+                    freeze(node_cast<anode>(_node));
+            } else if (_node.type() == node::enode) {
                 complete_expansion(_node);
+                b.failed();
+                i -= 1;
+            } else if (_node.type() == node::xnode) {
+                complete_compression(_node);
+                b.failed();
                 i -= 1;
             }
             i += 1;
         }
     }
 
-    auto freeze_and_compress(std::shared_ptr<anode> const& cur, int level) -> std::shared_ptr<base_node>
+    auto freeze_and_compress(anode* cur, int level) -> node_ptr
     {
-        std::shared_ptr<base_node> single;
+        node_ptr single;
         auto i = 0;
-        while (i < cur->values.size()) {
-            auto _node = std::atomic_load(&cur->values[i]);
+        backoff b;
+        while (i < static_cast<int>(cur->values.size())) {
+            hazard_pointer hp;
+            auto _node = hp.protect(cur->values[i]);
             if (!_node) {
-                std::shared_ptr<base_node> fvn = std::make_shared<fvnode>();
-                if (!std::atomic_compare_exchange_weak(&cur->values[i], &_node, fvn))
+                if (!cur->values[i].compare_exchange_weak(_node, node_ptr{node::fvnode})) {
+                    b.failed();
                     i -= 1;
-            } else if (_node->type() == node::snode) {
-                auto sn = std::static_pointer_cast<snode>(_node);
-                auto txn = std::atomic_load(&sn->txn);
-                if (txn->type() == node::notxn) {
-                    std::shared_ptr<base_node> fsn = std::make_shared<fsnode>();
-                    if (!std::atomic_compare_exchange_weak(&sn->txn, &txn, fsn)) {
+                }
+            } else if (_node.type() == node::snode) {
+                auto sn = node_cast<snode>(_node);
+                auto txn = sn->txn.load();
+                if (txn.type() == node::notxn) {
+                    if (!sn->txn.compare_exchange_weak(txn, node_ptr{node::fsnode})) {
+                        b.failed();
                         i -= 1;
                     } else {
-                        if (!single) single = sn;
-                        else single = cur;
+                        if (!single) single = _node;
+                        else single = node_ptr{cur};
                     }
-                } else if (txn->type() != node::fsnode) {
-                    single = cur;
+                } else if (txn.type() == node::fsnode) {
+                    single = node_ptr{cur};
                 } else {
-                    single = cur;
-                    std::atomic_compare_exchange_weak(&cur->values[i], &_node, txn);
+                    single = node_ptr{cur};
+                    if (cur->values[i].compare_exchange_strong(_node, txn))
+                        reclaimer::retire(sn, dispose_as<snode>);
+                    b.failed();
                     i -= 1;
                 }
-            } else if (_node->type() == node::anode) {
-                single = cur;
-                auto an = std::static_pointer_cast<anode>(_node);
-                std::shared_ptr<base_node> fn{std::make_shared<fnode>(an)};
-                std::atomic_compare_exchange_weak(&cur->values[i], &_node, fn);
+            } else if (_node.type() == node::anode) {
+                single = node_ptr{cur};
+                cur->values[i].compare_exchange_strong(_node, node_ptr{_node.address(), node::fnode});
                 i -= 1;
-            } else if (_node->type() == node::fnode) {
-                single = cur;
-                auto fn = std::static_pointer_cast<fnode>(_node);
-                freeze(std::atomic_load(&fn->frozen));
-            } else if (_node->type() == node::fvnode) {
-                single = cur;
-            } else if (_node->type() == node::enode) {
-                single = cur;
+            } else if (_node.type() == node::lnode) {
+                single = node_ptr{cur};
+                if (!cur->values[i].compare_exchange_weak(_node, node_ptr{_node.address(), node::flnode})) {
+                    b.failed();
+                    i -= 1;
+                }
+            } else if (_node.type() == node::fnode) {
+                single = node_ptr{cur};
+                freeze(node_cast<anode>(_node));
+            } else if (_node.type() == node::fvnode || _node.type() == node::flnode) {
+                single = node_ptr{cur};
+            } else if (_node.type() == node::enode) {
+                single = node_ptr{cur};
                 complete_expansion(_node);
+                b.failed();
                 i -= 1;
-            } else if (_node->type() == node::xnode) {
-                single = cur;
-                auto xn = std::static_pointer_cast<xnode>(_node);
-                complete_compression(xn);
+            } else if (_node.type() == node::xnode) {
+                single = node_ptr{cur};
+                complete_compression(_node);
+                b.failed();
                 i -= 1;
             }
             i += 1;
         }
-        if (single->type() == node::snode) {
-            auto oldsn = std::static_pointer_cast<snode>(single);
-            single = std::make_shared<snode>(oldsn->hash, oldsn->key, oldsn->value);
-            return single;
+        if (single.type() == node::snode) {
+            auto oldsn = node_cast<snode>(single);
+            return node_ptr{make<snode>(oldsn->hash, oldsn->key, oldsn->value)};
         } else if (single) {
             return compress_frozen(cur, level);
         } else {
@@ -621,54 +2184,303 @@ struct trie
         }
     }
 
-    auto compress_frozen(std::shared_ptr<anode> const& frozen, int level) -> std::shared_ptr<base_node>
+    // what the frozen anode at level leaves in its parent: nothing, a copy
+    // of its only leaf, a narrow copy of a wide one whose leaves fit one, see
+    // sparse, or else a copy of the same size. the anodes below a wide one
+    // are flattened into the copy by sequential_transfer.
+    auto compress_frozen(anode* frozen, int level) -> node_ptr
     {
-        std::shared_ptr<base_node> single;
-        auto i = 0;
-        while (i < frozen->values.size()) {
-            auto old = std::atomic_load(&frozen->values[i]);
-            if (old->type() != node::fvnode) {
-                if (!single && old->type() == node::snode) {
-                    single = old;
-                } else {
-                    if (frozen->values.size() == 16) {
-                        auto wide{std::make_shared<anode>(16)};
-                        sequential_transfer(frozen, wide, level);
-                        return wide;
-                    } else {
-                        auto narrow{std::make_shared<anode>(4)};
-                        sequential_transfer_narrow(frozen, narrow);
-                        return narrow;
-                    }
-                }
+        node_ptr single;
+        auto live = 0;
+        auto leaves = true;
+        auto narrow = frozen->values.size() == 16;
+        unsigned taken = 0;
+        for (auto& slot : frozen->values) {
+            auto old = slot.load();
+            if (old.type() == node::fvnode)
+                continue;
+            live += 1;
+            if (old.type() == node::snode || old.type() == node::flnode) {
+                single = old;
+                auto bit = 1u << ((leaf_hash(old) >> level) & 3);
+                narrow = narrow && !(taken & bit);
+                taken |= bit;
+            } else {
+                leaves = false;
             }
-            i += 1;
         }
-        if (single) {
-            // TODO ?
-            auto oldsn = std::static_pointer_cast<snode>(single);
-            single = std::make_shared<snode>(oldsn->hash, oldsn->key, oldsn->value);
+        if (live == 0)
+            return {};
+        if (live == 1 && leaves)
+            return copy_leaf(single);
+        if (narrow && leaves) {
+            auto an = make_anode(4, frozen->gen);
+            for (auto& slot : frozen->values) {
+                auto old = slot.load();
+                if (old.type() != node::fvnode)
+                    an->values[(leaf_hash(old) >> level) & 3].store(copy_leaf(old), std::memory_order_relaxed);
+            }
+            return node_ptr{an};
+        }
+        auto an = make_anode(static_cast<int>(frozen->values.size()), frozen->gen);
+        if (an->values.size() == 16)
+            sequential_transfer(frozen, an, level);
+        else
+            sequential_transfer_narrow(frozen, an);
+        return node_ptr{an};
+    }
+
+    // a copy of the frozen snode or flnode u, which stays with its anode
+    static auto copy_leaf(node_ptr u) -> node_ptr
+    {
+        if (u.type() == node::snode) {
+            auto sn = node_cast<snode>(u);
+            return node_ptr{make<snode>(sn->hash, sn->key, sn->value)};
+        }
+        return node_ptr{make<lnode>(*node_cast<lnode>(u))};
+    }
+
+    // every node lives in a block of allocator, an anode together with its
+    // slots.
+    template <class U, class... Args>
+    static auto make(Args&&... args) -> U*
+    {
+        static_assert(alignof(U) <= allocator::granule);
+        return new (allocator::allocate(sizeof(U))) U(std::forward<Args>(args)...);
+    }
+
+    static auto make_anode(int size, std::uint64_t gen) -> anode*
+    {
+        return new (allocator::allocate(anode::bytes(size))) anode(size, gen);
+    }
+
+    template <class U>
+    static void dispose(U* p)
+    {
+        auto size = sizeof(U);
+        if constexpr (std::is_same_v<U, anode>)
+            size = anode::bytes(p->values.size());
+        p->~U();
+        allocator::deallocate(p, size);
+    }
+
+    // dispose as a deleter of the reclaimer
+    template <class U>
+    static void dispose_as(void* p)
+    {
+        dispose(static_cast<U*>(p));
+    }
+
+    // the deleter of unlinked anodes, frozen ones or those of an older
+    // generation a snapshot let go of. drops one reference, the last frees
+    // the snodes and lnodes in its slots, and only now retires the anodes
+    // below it.
+    static void unref(void* p)
+    {
+        auto an = static_cast<anode*>(p);
+        if (an->refs.fetch_sub(1) > 1)
+            return;
+        for (auto& slot : an->values) {
+            auto u = slot.load(std::memory_order_relaxed);
+            if (u.type() == node::snode)
+                dispose(node_cast<snode>(u));
+            else if (u.type() == node::lnode || u.type() == node::flnode)
+                dispose(node_cast<lnode>(u));
+            else if (u.type() == node::anode || u.type() == node::fnode)
+                reclaimer::retire(u.address(), unref);
+        }
+        dispose(an);
+    }
+
+    // retire the enode or xnode heading a frozen subtree that has just been
+    // unlinked. the anodes below it might still be referenced by the current
+    // cache, so it is buried there and retired when the cache is replaced. a
+    // cache that becomes current later can not reach the subtree any more.
+    // level is that of the topmost anode of the subtree, a cache above it
+    // never held any of them, see inhabit.
+    void retire_unlinked(void* p, deleter_type deleter, int level = 0)
+    {
+        hazard_pointer hc;
+        auto c = hc.protect(cache);
+        if (c && c->level >= level)
+            bury(c, p, deleter);
+        else
+            reclaimer::retire(p, deleter);
+    }
+
+    // frees a node that was never published, or any node once the trie is
+    // quiescent, together with everything below it that no snapshot shares.
+    // markers own nothing.
+    static void destroy(node_ptr u)
+    {
+        if (!u) {
+            return;
+        } else if (u.type() == node::anode) {
+            auto an = node_cast<anode>(u);
+            if (an->refs.fetch_sub(1) > 1)
+                return;
+            for (auto& slot : an->values)
+                destroy(slot.load(std::memory_order_relaxed));
+            dispose(an);
+        } else if (u.type() == node::snode) {
+            auto sn = node_cast<snode>(u);
+            destroy(sn->txn.load(std::memory_order_relaxed));
+            dispose(sn);
+        } else if (u.type() == node::lnode || u.type() == node::flnode) {
+            dispose(node_cast<lnode>(u));
+        } else if (u.type() == node::fnode) {
+            destroy(node_ptr{node_cast<anode>(u)});
+        } else if (u.type() == node::enode) {
+            auto en = node_cast<enode>(u);
+            destroy(node_ptr{en->narrow});
+            if (auto wide = en->wide.load(std::memory_order_relaxed))
+                destroy(node_ptr{wide});
+            dispose(en);
+        } else if (u.type() == node::xnode) {
+            auto xn = node_cast<xnode>(u);
+            destroy(node_ptr{xn->stale});
+            dispose(xn);
+        }
+    }
+
+    // the entry is checked against the current cache after it is protected,
+    // see retire_unlinked.
+    auto cached(cache_node* c, hash_type hash, hazard_pointer& hp) -> anode*
+    {
+        if (!c)
+            return {};
+        auto pos = hash & ((1 << c->level) - 1);
+        auto an = hp.protect(c->values[pos]);
+        if (cache.load() != c)
+            return {};
+        return an;
+    }
+
+    static void inhabit(cache_node* c, anode* cur, hash_type hash)
+    {
+        auto pos = hash & ((1 << c->level) - 1);
+        if (c->values[pos].load(std::memory_order_relaxed) != cur)
+            c->values[pos].store(cur);
+    }
+
+    void bury(cache_node* c, void* p, deleter_type deleter)
+    {
+        auto u = make<buried>(buried{p, deleter, c->graveyard.load()});
+        while (!c->graveyard.compare_exchange_weak(u->next, u))
+            ;
+        auto limit = std::max(min_graveyard_size, (1 << c->level) >> 4);
+        if (c->graveyard_size.fetch_add(1) + 1 == limit)
+            replace_cache(c, new cache_node(c->level));
+    }
+
+    // once c is no longer current nobody trusts its entries, so the nodes
+    // buried in it are retired right away. nc starts empty, copying the
+    // entries over would need every one of them protected.
+    void replace_cache(cache_node* c, cache_node* nc)
+    {
+        if (!cache.compare_exchange_strong(c, nc)) {
+            delete nc;
+            return;
+        }
+        if (c) {
+            c->release();
+            reclaimer::retire(c);
+        }
+    }
+
+    void record_cache_miss()
+    {
+        if (cache_misses.fetch_add(1) + 1 == cache_miss_threshold) {
+            adjust_cache_level();
+            cache_misses.store(0);
+        }
+    }
+
+    // walk down from root along the hash, return the level of the anode
+    // holding the snode we end up at, or -1 if the walk ends at empty slot.
+    // three hazard pointers, since the anode below an fnode is only safe as
+    // long as the parent of the fnode is, and one for root, which a snapshot
+    // may swap and retire.
+    auto sample_level(hash_type hash) -> int
+    {
+        hazard_pointer hr;
+        hazard_pointer hp[3];
+        auto level = 0;
+        auto cur = hr.protect(root);
+        while (true) {
+            auto pos = (hash >> level) & (cur->values.size() - 1);
+            auto old = hp[level / 4 % 3].protect(cur->values[pos]);
+            if (!old) {
+                return -1;
+            } else if (old.type() == node::anode || old.type() == node::fnode) {
+                cur = node_cast<anode>(old);
+            } else if (old.type() == node::snode || old.type() == node::lnode
+                || old.type() == node::flnode) {
+                return level;
+            } else if (old.type() == node::enode) {
+                cur = node_cast<enode>(old)->narrow;
+            } else if (old.type() == node::xnode) {
+                cur = node_cast<xnode>(old)->stale;
+            } else {
+                return -1;
+            }
+            level += 4;
         }
-        return single;
     }
 
+    // not inlined, a random_device takes some 5kB of the frame it is built in
+    [[gnu::noinline]] static auto random_engine() -> std::mt19937&
+    {
+        thread_local std::mt19937 gen{std::random_device{}()};
+        return gen;
+    }
+
+    // sample random paths and move the cache to the level that holds most of
+    // the snodes, the old cache is retired.
+    void adjust_cache_level()
+    {
+        auto& gen = random_engine();
+        std::uniform_int_distribution<hash_type> dis{
+            std::numeric_limits<hash_type>::min(),
+            std::numeric_limits<hash_type>::max()
+        };
+
+        std::vector<int> histogram(hash_bits / 4);
+        for (auto i = 0; i < cache_samples; i++) {
+            auto level = sample_level(dis(gen));
+            if (level >= 0)
+                histogram[level / 4] += 1;
+        }
+        auto best = std::max_element(histogram.begin(), histogram.end());
+        auto level = std::min(
+            static_cast<int>(best - histogram.begin()) * 4,
+            max_cache_level
+        );
+        if (level < min_cache_level)
+            return;
+
+        hazard_pointer hc;
+        auto c = hc.protect(cache);
+        if (!c || c->level != level)
+            replace_cache(c, new cache_node(level));
+    }
 
-    // TODO key_type = value_type = hash_type
-    auto debug_lookup(hash_type hash) -> std::optional<value_type>
+    // TODO key_type = value_type
+    auto debug_lookup(key_type const& key) -> std::optional<value_type>
     {
-        return lookup(hash, hash, 0, std::atomic_load(&root));
+        return lookup(key);
     }
 
-    // TODO key_type = value_type = hash_type
-    void debug_insert(hash_type hash)
+    // TODO key_type = value_type
+    void debug_insert(key_type const& key)
     {
-        insert(hash, hash, hash);
+        insert(key, key);
     }
 
-    // TODO key_type = value_type = hash_type
-    auto debug_remove(hash_type hash) -> std::optional<value_type>
+    // TODO key_type = value_type
+    auto debug_remove(key_type const& key) -> std::optional<value_type>
     {
-        return remove(hash, hash);
+        return remove(key);
     }
 
     void print_prefix(std::string const& prefix) const
@@ -685,50 +2497,54 @@ struct trie
             std::cout << "├── ";
     }
 
-    void print_node(std::shared_ptr<base_node> const& u) const
+    void print_node(node_ptr u) const
     {
         if (!u) {
             std::cout << "(empty)\n";
-        } else if (u->type() == node::base) {
-            std::cout << "(base)\n";
-        } else if (u->type() == node::anode) {
-            auto au = std::static_pointer_cast<anode>(u);
+        } else if (u.type() == node::anode) {
+            auto au = node_cast<anode>(u);
             std::cout << "(anode, size=" << au->values.size() << ")\n";
-        } else if (u->type() == node::snode) {
-            auto su = std::static_pointer_cast<snode>(u);
-            std::cout << "(snode, value=" << su->value << ", txn=" << su->txn->type() << ")\n";
-        } else if (u->type() == node::notxn) {
-            std::cout << "(notxn)\n";
-        } else if (u->type() == node::fsnode) {
-            std::cout << "(fsnode)\n";
-        } else if (u->type() == node::fvnode) {
-            std::cout << "(fvnode)\n";
-        } else if (u->type() == node::fnode) {
-            std::cout << "(fnode)\n";
-        } else if (u->type() == node::enode) {
-            std::cout << "(enode)\n";
+        } else if (u.type() == node::snode) {
+            auto su = node_cast<snode>(u);
+            auto txn = su->txn.load();
+            std::cout << "(snode, value=" << load(su) << ", txn=";
+            if (txn)
+                std::cout << txn.type();
+            else
+                std::cout << "null";
+            std::cout << ")\n";
+        } else if (u.type() == node::lnode || u.type() == node::flnode) {
+            auto lu = node_cast<lnode>(u);
+            std::cout << "(" << u.type() << ", size=" << lu->entries.count() << ")\n";
+        } else {
+            std::cout << "(" << u.type() << ")\n";
         }
     }
 
-    void print(std::shared_ptr<base_node> const& u, std::string const& prefix) const
+    void print(node_ptr u, std::string const& prefix) const
     {
         print_prefix(prefix);
         print_node(u);
-        if (u && u->type() == node::anode) {
-            auto au = std::static_pointer_cast<anode>(u);
+        if (u.type() == node::anode) {
+            auto au = node_cast<anode>(u);
             auto n = au->values.size();
             for (auto i = 0u; i < n; i++)
-                print(au->values[i], prefix + (i == n - 1 ? ' ' : '|'));
+                print(au->values[i].load(), prefix + (i == n - 1 ? ' ' : '|'));
         }
     }
 
     void print() const
     {
-        print(root, {});
+        guard g;
+        print(node_ptr{root.load()}, {});
     }
 
-    std::shared_ptr<anode> root{std::make_shared<anode>(16)};
+    std::atomic<anode*> root{make_anode(16, new_generation())};
+    // the old root while a snapshot is taken
+    std::atomic<anode*> unsettled{nullptr};
+    std::atomic<cache_node*> cache{nullptr};
+    std::atomic<int> cache_misses{0};
+    hasher hash_function;
 };
 
 } // namespace concurrent
-
@@ -0,0 +1,80 @@
+// ml:ccf += -pthread
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include "../util/allocations.hh"
+#include "../util/throughput.hh"
+#include "trie.hh"
+
+// overwrites of keys that are there, half of the ops, the others lookups,
+// by insert and by fetch_add. int values are updated in place, values of 16
+// bytes get a new snode every time, as every value did before. allocations
+// are counted by util::allocations.
+//
+// usage: update-bench [max threads] [duration ms]
+
+// too wide to be updated in place
+struct wide_value
+{
+    wide_value(long v = 0) : v(v) {}
+
+    friend auto operator+(wide_value a, wide_value b) { return wide_value{a.v + b.v}; }
+
+    long v;
+    long pad{0};
+};
+
+template <class Value>
+struct insert_map : concurrent::trie<int, Value>
+{
+};
+
+// insert is a fetch_add of one
+template <class Value>
+struct counter_map : concurrent::trie<int, Value>
+{
+    void insert(int key, int) { this->fetch_add(key, 1); }
+};
+
+template <class Map>
+void bench(std::string const& name, util::workload const& w, std::vector<int> const& counts)
+{
+    std::cout << "testing [" << name << ", " << w.lookup << "% lookup "
+        << w.insert << "% update, " << w.key_range << " keys]\n";
+    for (auto threads : counts) {
+        Map m;
+        util::prefill(m, w);
+        auto before = util::allocations.load();
+        auto res = util::bench_throughput(m, threads, w);
+        auto ops = res.total * std::chrono::duration<double>(w.duration).count();
+        util::print(res);
+        std::cout << "    " << std::fixed << std::setprecision(3)
+            << (util::allocations.load() - before) / ops << " allocations/op\n" << std::defaultfloat;
+    }
+    std::cout << std::string(80, '=') << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    auto hardware = static_cast<int>(std::thread::hardware_concurrency());
+    auto max_threads = argc > 1 ? std::atoi(argv[1]) : std::max(4, hardware);
+    auto counts = util::thread_counts(max_threads);
+    static_assert(concurrent::trie<int, int>::in_place || !concurrent::double_word::supported);
+    static_assert(!concurrent::trie<int, wide_value>::in_place);
+
+    util::workload w;
+    w.lookup = 50;
+    w.insert = 50;
+    w.remove = 0;
+    w.key_range = 1 << 16;
+    w.prefill = 1;
+    if (argc > 2)
+        w.duration = std::chrono::milliseconds{std::atoi(argv[2])};
+    bench<insert_map<int>>("insert, in place", w, counts);
+    bench<insert_map<wide_value>>("insert, 16 bytes", w, counts);
+    bench<counter_map<int>>("fetch_add, in place", w, counts);
+    bench<counter_map<wide_value>>("fetch_add, 16 bytes", w, counts);
+}
@@ -0,0 +1,76 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdlib>
+#include "../util/allocations.hh"
+#include "../util/timer.hh"
+#include "../util/memory.hh"
+#include "../util/throughput.hh"
+#include "raw-pointer-trie.hh"
+
+// the heap allocations the raw tries make, counted by util::allocations:
+// inserting keys 0..n-1 in a random order, then updating every key
+// once more in another order, which expands no node but replaces leaves.
+//
+// usage: alloc-bench [keys]
+
+template <class Run>
+void measure(std::string const& name, int keys, Run run)
+{
+    auto resident = util::resident_bytes();
+    auto calls = util::allocations.load();
+    auto bytes = util::allocated_bytes.load();
+    util::timer t;
+    t.start();
+    run();
+    t.stop();
+    calls = util::allocations.load() - calls;
+    bytes = util::allocated_bytes.load() - bytes;
+    resident = util::resident_bytes() - resident;
+    std::cout << "    " << std::left << std::setw(8) << name << std::right
+        << std::fixed << std::setprecision(2)
+        << t.elapsed_milliseconds() << " ms, "
+        << calls << " allocations, " << static_cast<double>(calls) / keys << " per key, "
+        << static_cast<double>(bytes) / keys << " bytes/key allocated, "
+        << static_cast<double>(resident) / keys << " bytes/key resident\n"
+        << std::defaultfloat;
+}
+
+template <class Trie>
+void bench(std::string const& name, std::vector<int> const& keys, std::vector<int> const& updates)
+{
+    std::cout << "testing [" << name << ", " << keys.size() << " keys]\n";
+    auto n = static_cast<int>(keys.size());
+    Trie t;
+    measure("insert", n, [&] {
+        for (auto key : keys)
+            t.insert(key, key);
+    });
+    measure("update", n, [&] {
+        for (auto key : updates)
+            t.insert(key, -key);
+    });
+    std::cout << std::string(80, '=') << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    auto n = argc > 1 ? std::atoi(argv[1]) : 4'000'000;
+
+    util::fast_random gen{1};
+    auto shuffled = [&] {
+        std::vector<int> keys(n);
+        for (auto key = 0; key < n; key++)
+            keys[key] = key;
+        for (auto i = n - 1; i > 0; i--)
+            std::swap(keys[i], keys[gen() % (i + 1)]);
+        return keys;
+    };
+    auto keys = shuffled();
+    auto updates = shuffled();
+
+    bench<sequential::raw_trie<int, int>>("raw trie", keys, updates);
+    bench<sequential::raw_trie_mem_pool<int, int>>("raw trie with memory pool", keys, updates);
+}
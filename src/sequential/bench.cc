@@ -43,7 +43,7 @@ int main()
         size, 4, "raw trie"
     );
 
-    util::bench_insert<sequential::raw_trie_mem_pool<int, int, size>>(
+    util::bench_insert<sequential::raw_trie_mem_pool<int, int>>(
         size, 4, "raw trie with memory pool"
     );
 
@@ -0,0 +1,66 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include "../util/timer.hh"
+#include "../util/memory.hh"
+#include "../util/throughput.hh"
+#include "raw-pointer-trie.hh"
+
+// the resident set of raw_trie over time under updates: a trie of keys
+// 0..n-1 that takes rounds of random updates of keys 0..2n-1, half of them
+// new at first, then a trie built from scratch and dropped every round. a
+// trie that frees what it replaces levels off in both, one that does not
+// grows with every round.
+//
+// usage: churn-bench [keys] [updates per round] [rounds]
+
+void report(int round, util::timer const& t, long ops, std::size_t base)
+{
+    std::cout << "    round " << std::setw(3) << round << ": " << std::fixed << std::setprecision(2)
+        << t.elapsed_seconds() * 1e9 / ops << " ns/op, "
+        << static_cast<double>(util::resident_bytes() - base) / (1 << 20) << " MB resident\n"
+        << std::defaultfloat;
+}
+
+int main(int argc, char** argv)
+{
+    auto n = argc > 1 ? std::atoi(argv[1]) : 1'000'000;
+    auto updates = argc > 2 ? std::atoi(argv[2]) : 4'000'000;
+    auto rounds = argc > 3 ? std::atoi(argv[3]) : 10;
+    auto base = util::resident_bytes();
+    util::fast_random gen{1};
+
+    std::cout << "testing [raw trie, updates of " << n << " keys]\n";
+    {
+        sequential::raw_trie<int, int> t;
+        for (auto key = 0; key < n; key++)
+            t.insert(key, key);
+        for (auto round = 0; round < rounds; round++) {
+            util::timer timer;
+            timer.start();
+            for (auto i = 0; i < updates; i++) {
+                auto key = static_cast<int>(gen() % (2 * static_cast<std::uint64_t>(n)));
+                t.insert(key, i);
+            }
+            timer.stop();
+            report(round, timer, updates, base);
+        }
+    }
+    std::cout << std::string(80, '=') << "\n";
+
+    std::cout << "testing [raw trie, rebuilt from " << n << " keys]\n";
+    for (auto round = 0; round < rounds; round++) {
+        util::timer timer;
+        timer.start();
+        {
+            sequential::raw_trie<int, int> t;
+            for (auto i = 0; i < n; i++)
+                t.insert(static_cast<int>(gen() % (2 * static_cast<std::uint64_t>(n))), i);
+        }
+        timer.stop();
+        report(round, timer, n, base);
+    }
+    std::cout << std::string(80, '=') << "\n";
+}
@@ -0,0 +1,70 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+#include <cstdlib>
+#include "../util/timer.hh"
+#include "../util/perf.hh"
+#include "../util/memory.hh"
+#include "../util/throughput.hh"
+#include "raw-pointer-trie.hh"
+
+// what the node layout of the raw tries costs: the bytes a key takes, by the
+// resident set before and after inserting keys 0..n-1 in a random order, and
+// random lookups of twice the key range, so that half of them miss.
+//
+// usage: layout-bench [keys] [lookups]
+
+template <class Trie>
+void bench(std::string const& name, std::vector<int> const& keys, std::vector<int> const& queries)
+{
+    std::cout << "testing [" << name << ", " << keys.size() << " keys]\n";
+    auto before = util::resident_bytes();
+    auto t = new Trie;
+    util::timer fill;
+    fill.start();
+    for (auto key : keys)
+        t->insert(key, key);
+    fill.stop();
+    auto bytes = util::resident_bytes() - before;
+    std::cout << std::fixed << std::setprecision(2)
+        << "    insert " << fill.elapsed_milliseconds() << " ms, "
+        << static_cast<double>(bytes) / keys.size() << " bytes/key\n";
+
+    util::timer timer;
+    util::perf_counters counters;
+    long found = 0;
+    counters.start();
+    timer.start();
+    for (auto key : queries)
+        found += t->lookup(key).has_value();
+    timer.stop();
+    counters.stop();
+    std::cout << "    lookup " << timer.elapsed_seconds() * 1e9 / queries.size()
+        << " ns/lookup, " << found << " found\n" << std::defaultfloat;
+    std::cout << "    ";
+    counters.print(std::cout, static_cast<double>(queries.size()));
+    std::cout << std::string(80, '=') << "\n";
+    // the raw tries free nothing, neither does the benchmark
+}
+
+int main(int argc, char** argv)
+{
+    auto n = argc > 1 ? std::atoi(argv[1]) : 10'000'000;
+    auto lookups = argc > 2 ? std::atoi(argv[2]) : 4'000'000;
+
+    util::fast_random gen{1};
+    std::vector<int> keys(n);
+    for (auto key = 0; key < n; key++)
+        keys[key] = key;
+    for (auto i = n - 1; i > 0; i--)
+        std::swap(keys[i], keys[gen() % (i + 1)]);
+    std::vector<int> queries(lookups);
+    for (auto& key : queries)
+        key = static_cast<int>(gen() % (2 * static_cast<std::uint64_t>(n)));
+
+    bench<sequential::raw_trie<int, int>>("raw trie", keys, queries);
+    bench<sequential::raw_trie_mem_pool<int, int>>("raw trie with memory pool", keys, queries);
+}
@@ -3,49 +3,166 @@
 #include <vector>
 #include <string>
 #include <optional>
+#include <memory>
+#include <iterator>
+#include <utility>
+#include <cstdint>
+#include "../util/bucket.hh"
+#include "../util/bulk.hh"
+#include "../util/hash.hh"
+#include "../util/slab.hh"
+#include "../util/stats.hh"
 
 namespace sequential
 {
 
-template <class Key, class T>
+enum class raw_node : std::uint8_t
+{
+    empty,
+    leaf,
+    narrow,
+    wide,
+};
+
+// a pointer to a node of the raw tries with the kind of the node in its
+// lowest two bits, like concurrent::node_ptr. an anode is no more than its
+// slots, narrow or wide by the tag, so a lookup goes from a slot straight to
+// the slot below, and only a leaf is read for more than its address.
+struct raw_ptr
+{
+    static constexpr std::uintptr_t tag_mask = 0x3;
+
+    raw_ptr() = default;
+
+    raw_ptr(void const* p, raw_node kind)
+        : bits(reinterpret_cast<std::uintptr_t>(p) | static_cast<std::uintptr_t>(kind)) {}
+
+    template <class U>
+    explicit raw_ptr(U* p) : raw_ptr(p, U::kind)
+    {
+        static_assert(alignof(U) > tag_mask);
+    }
+
+    explicit operator bool() const { return bits != 0; }
+
+    auto kind() const -> raw_node { return static_cast<raw_node>(bits & tag_mask); }
+
+    auto is_leaf() const { return kind() == raw_node::leaf; }
+
+    // the number of slots of an anode
+    auto size() const -> int { return kind() == raw_node::narrow ? 4 : 16; }
+
+    auto address() const -> void* { return reinterpret_cast<void*>(bits & ~tag_mask); }
+
+    // the slots of an anode, the first member of either size
+    auto slots() const -> raw_ptr* { return static_cast<raw_ptr*>(address()); }
+
+    std::uintptr_t bits{0};
+};
+
+template <class U>
+auto raw_cast(raw_ptr u) -> U*
+{
+    return static_cast<U*>(u.address());
+}
+
+// the slots of an anode, narrow for Size = 4 and wide for Size = 16
+template <int Size>
+struct raw_anode
+{
+    static constexpr auto kind = Size == 4 ? raw_node::narrow : raw_node::wide;
+
+    raw_ptr values[Size]{};
+};
+
+template <class Key, class T, class Hash = util::hash<Key>>
 struct raw_trie
 {
     using key_type   = Key;
     using value_type = T;
-    using hash_type  = int;
+    using hash_type  = util::hash_result_t<Hash, Key>;
+    using hasher     = Hash;
+    using bucket_type = util::bucket<key_type, value_type>;
 
-    struct node
+    struct leaf
     {
-        node(hash_type hash, key_type const& key, value_type const& value)
-            : hash(hash), key(key), value(value), _leaf(true) {}
-
-        node(int size) : _leaf(false), values(size) {}
-
-        auto is_leaf() const { return _leaf; }
+        static constexpr auto kind = raw_node::leaf;
 
         hash_type hash;
         key_type key;
         value_type value;
-        bool _leaf;
-
-        std::vector<node*> values;
+        // set on the lnodes, leaves whose keys share the hash. the leaf owns
+        // the chain, so whatever destroys the leaf frees it
+        std::unique_ptr<bucket_type> list{};
     };
 
+    using narrow = raw_anode<4>;
+    using wide = raw_anode<16>;
+
+    raw_trie() = default;
+
+    raw_trie(raw_trie const&) = delete;
+    raw_trie& operator=(raw_trie const&) = delete;
+
+    ~raw_trie()
+    {
+        clear();
+        delete root;
+    }
+
+    // frees every node but root, whose slots are emptied
+    void clear()
+    {
+        for (auto& u : root->values) {
+            release(u);
+            u = {};
+        }
+    }
+
+    // frees u and everything below it
+    static void release(raw_ptr u)
+    {
+        if (!u)
+            return;
+        if (u.is_leaf()) {
+            delete raw_cast<leaf>(u);
+            return;
+        }
+        auto n = u.size();
+        for (auto i = 0; i < n; i++)
+            release(u.slots()[i]);
+        delete_anode(u);
+    }
+
+    static void delete_anode(raw_ptr u)
+    {
+        if (u.kind() == raw_node::narrow)
+            delete raw_cast<narrow>(u);
+        else
+            delete raw_cast<wide>(u);
+    }
+
     auto lookup(
         key_type const& key,
         hash_type hash,
         int level,
-        node* cur
+        raw_ptr cur
     ) const -> std::optional<value_type>
     {
-        auto pos = (hash >> level) & (cur->values.size() - 1);
-        auto u = cur->values[pos];
+        auto pos = (hash >> level) & (cur.size() - 1);
+        auto u = cur.slots()[pos];
         if (!u) return {};
-        if (!u->is_leaf()) {
+        if (!u.is_leaf()) {
             return lookup(key, hash, level + 4, u);
+        }
+        auto l = raw_cast<leaf>(u);
+        if (l->list) {
+            if (auto v = l->list->find(key))
+                return *v;
+            return {};
         } else {
-            if (u->key == key)
-                return u->value;
+            if (l->key == key)
+                return l->value;
             else
                 return {};
         }
@@ -56,49 +173,210 @@ struct raw_trie
         value_type const& value,
         hash_type hash,
         int level,
-        node* cur,
-        node* prev
+        raw_ptr cur,
+        raw_ptr prev
     )
     {
         // std::cerr << "inserting: hash=" << hash << ", level=" << level << "\n";
-        auto pos = (hash >> level) & ((cur->values).size() - 1);
-        auto u = cur->values[pos];
+        auto pos = (hash >> level) & (cur.size() - 1);
+        auto u = cur.slots()[pos];
         if (!u) {
-            auto v = new node(hash, key, value);
-            cur->values[pos] = v;
-        } else if (!u->is_leaf()) {
+            auto v = new leaf{hash, key, value};
+            cur.slots()[pos] = raw_ptr{v};
+        } else if (!u.is_leaf()) {
             insert(key, value, hash, level + 4, u, cur);
         } else {
-            if (u->key == key) {
-                cur->values[pos] = new node(hash, key, value);
-            } else if (cur->values.size() == 4) {
-                auto ppos = (hash >> (level - 4)) & (prev->values.size() - 1);
+            auto l = raw_cast<leaf>(u);
+            if (l->hash == hash) {
+                if (l->list) {
+                    l->list->assign(key, value);
+                } else if (l->key == key) {
+                    // nothing else holds the leaf, so it is updated in place
+                    l->value = value;
+                } else {
+                    // the first collision of the full hash makes l an lnode
+                    l->list = std::make_unique<bucket_type>();
+                    l->list->assign(l->key, l->value);
+                    l->list->assign(key, value);
+                }
+            } else if (cur.kind() == raw_node::narrow) {
+                auto ppos = (hash >> (level - 4)) & (prev.size() - 1);
                 complete_expansion(prev, ppos, cur, level);
-                insert(key, value, hash, level, prev->values[ppos], prev);
+                insert(key, value, hash, level, prev.slots()[ppos], prev);
             } else {
-                auto sn = new node(hash, key, value);
-                auto an = create_anode(u, sn, level + 4);
-                cur->values[pos] = an;
+                auto sn = new leaf{hash, key, value};
+                auto an = create_anode(l, sn, level + 4);
+                cur.slots()[pos] = an;
+            }
+        }
+    }
+
+    auto hash(key_type const& key) const -> hash_type
+    {
+        return static_cast<hash_type>(hash_function(key));
+    }
+
+    auto lookup(key_type const& key) const -> std::optional<value_type>
+    {
+        return lookup(key, hash(key), 0, raw_ptr{root});
+    }
+
+    // a lookup of lookup_many in flight
+    struct probe
+    {
+        std::size_t index;
+        hash_type hash;
+        int level;
+        raw_ptr const* slot;
+        leaf* found;
+    };
+
+    // twice the group of concurrent::trie, nothing bounds it here
+    static constexpr int lookup_group = 32;
+
+    // lookups of keys[i] into out[i], lookup_group at a time and interleaved,
+    // see concurrent::trie::lookup_many. the kind of a node is in the slot,
+    // so a level takes a step, from the slot to the slot below, and the leaf
+    // one more.
+    template <class Keys, class Out>
+    void lookup_many(Keys const& keys, Out& out) const
+    {
+        auto k = std::begin(keys);
+        auto o = std::begin(out);
+        auto n = static_cast<std::size_t>(std::distance(k, std::end(keys)));
+        probe probes[lookup_group];
+        auto active = 0;
+        std::size_t next = 0;
+        auto start = [&](probe& p) {
+            p.index = next++;
+            p.hash = hash(k[p.index]);
+            p.level = 0;
+            p.slot = &root->values[p.hash & (16 - 1)];
+            p.found = nullptr;
+            __builtin_prefetch(p.slot);
+        };
+        for (; active < lookup_group && next < n; active++)
+            start(probes[active]);
+        while (active) {
+            for (auto i = 0; i < active; ) {
+                auto& p = probes[i];
+                if (!step(p, k[p.index], o[p.index])) {
+                    i++;
+                } else if (next < n) {
+                    start(p);
+                    i++;
+                } else {
+                    p = probes[--active];
+                }
+            }
+        }
+    }
+
+    // one step of p, true once its result is in out
+    template <class Out>
+    static auto step(probe& p, key_type const& key, Out& out) -> bool
+    {
+        if (!p.found) {
+            auto u = *p.slot;
+            if (!u) {
+                out = std::nullopt;
+                return true;
             }
+            if (!u.is_leaf()) {
+                p.level += 4;
+                p.slot = &u.slots()[(p.hash >> p.level) & (u.size() - 1)];
+                __builtin_prefetch(p.slot);
+                return false;
+            }
+            p.found = raw_cast<leaf>(u);
+            __builtin_prefetch(p.found);
+            return false;
         }
+        auto l = p.found;
+        if (l->list) {
+            if (auto v = l->list->find(key))
+                out = *v;
+            else
+                out = std::nullopt;
+        } else if (l->key == key) {
+            out = l->value;
+        } else {
+            out = std::nullopt;
+        }
+        return true;
+    }
+
+    void insert(key_type const& key, value_type const& value)
+    {
+        insert(key, value, hash(key));
     }
 
     void insert(key_type const& key, value_type const& value, hash_type hash)
     {
-        insert(key, value, hash, 0, root, nullptr);
+        insert(key, value, hash, 0, raw_ptr{root}, raw_ptr{});
+    }
+
+    // the pairs of items, a random access range, as if they were inserted in
+    // order, on threads threads. the batch is split by root slot, see
+    // util::hashed_batch, and the subtree of every empty root slot is built
+    // apart by sequential_insert, then stored into root. slots that hold
+    // keys already get plain inserts.
+    template <class Range>
+    void bulk_load(Range const& items, int threads = util::hardware_threads())
+    {
+        auto first = std::begin(items);
+        auto n = static_cast<std::size_t>(std::distance(first, std::end(items)));
+        util::hashed_batch<hash_type> batch{n, [&](std::size_t i) {
+            auto const& [key, value] = first[i];
+            return hash(key);
+        }, threads};
+        util::parallel_tasks(threads, batch.slots, [&](int s) {
+            if (!root->values[s]) {
+                wide holder;
+                batch.for_each_run(s, [&](std::size_t i, std::size_t j) {
+                    sequential_insert(bulk_leaf(batch, first, i, j), &holder, 0);
+                });
+                root->values[s] = holder.values[s];
+                return;
+            }
+            for (auto i = batch.begin(s); i < batch.end(s); i++) {
+                auto const& [key, value] = first[batch.entries[i].second];
+                insert(key, value, batch.entries[i].first);
+            }
+        });
     }
 
-    // TODO key_type = value_type = hash_type
-    void debug_insert(hash_type hash)
+    // the leaf of the pairs of the entries [i, j) of batch, which share a
+    // hash: the last pair, with a list if there is more than one key among
+    // them.
+    template <class Batch, class Iterator>
+    static auto bulk_leaf(Batch const& batch, Iterator first, std::size_t i, std::size_t j) -> leaf*
     {
-        insert(hash, hash, hash);
+        std::unique_ptr<bucket_type> list;
+        if (j - i > 1) {
+            list = std::make_unique<bucket_type>();
+            for (auto k = i; k < j; k++) {
+                auto const& [key, value] = first[batch.entries[k].second];
+                list->assign(key, value);
+            }
+            if (list->count() == 1)
+                list.reset();
+        }
+        auto const& [key, value] = first[batch.entries[j - 1].second];
+        return new leaf{batch.entries[i].first, key, value, std::move(list)};
     }
 
-    // TODO key_type = value_type = hash_type
-    void debug_lookup(hash_type hash) const
+    // TODO key_type = value_type
+    void debug_insert(key_type const& key)
     {
-        std::cout << "lookup[" << hash << "] = ";
-        auto res = lookup(hash, hash, 0, root);
+        insert(key, key);
+    }
+
+    // TODO key_type = value_type
+    void debug_lookup(key_type const& key) const
+    {
+        std::cout << "lookup[" << key << "] = ";
+        auto res = lookup(key);
         if (res)
             std::cout << *res << "\n";
         else
@@ -106,115 +384,104 @@ struct raw_trie
     }
 
     void sequential_insert(
-        node* sn,
-        node* wide,
+        leaf* sn,
+        wide* an,
         int level
     )
     {
-        auto mask = wide->values.size() - 1;
-        auto pos = (sn->hash >> level) & mask;
-        if (!wide->values[pos])
-            wide->values[pos] = sn;
+        auto pos = (sn->hash >> level) & (16 - 1);
+        if (!an->values[pos])
+            an->values[pos] = raw_ptr{sn};
         else
-            sequential_insert(sn, wide, level, pos);
+            sequential_insert(sn, an, level, pos);
     }
 
     void sequential_insert(
-        node* sn,
-        node* wide,
+        leaf* sn,
+        wide* an,
         int level,
         int pos
     )
     {
-        auto u = wide->values[pos];
-        if (u->is_leaf()) {
-            auto an = create_anode(sn, u, level + 4);
-            wide->values[pos] = an;
+        auto u = an->values[pos];
+        if (u.is_leaf()) {
+            an->values[pos] = create_anode(sn, raw_cast<leaf>(u), level + 4);
         } else {
-            auto mask = u->values.size() - 1;
-            auto npos = (sn->hash >> (level + 4)) & mask;
-            if (!u->values[npos]) {
-                u->values[npos] = sn;
-            } else if (u->values.size() == 4) {
-                auto an = new node(16);
-                sequential_transfer(u, an, level + 4);
-                wide->values[pos] = an;
-                sequential_insert(sn, wide, level, pos);
+            auto npos = (sn->hash >> (level + 4)) & (u.size() - 1);
+            if (!u.slots()[npos]) {
+                u.slots()[npos] = raw_ptr{sn};
+            } else if (u.kind() == raw_node::narrow) {
+                auto w = new wide;
+                sequential_transfer(u, w, level + 4);
+                an->values[pos] = raw_ptr{w};
+                sequential_insert(sn, an, level, pos);
             } else {
-                sequential_insert(sn, u, level + 4, npos);
+                sequential_insert(sn, raw_cast<wide>(u), level + 4, npos);
             }
         }
     }
 
+    // the leaves below source move to an, source and the anodes below it
+    // are freed
     void sequential_transfer(
-        node* source,
-        node* wide,
+        raw_ptr source,
+        wide* an,
         int level
     )
     {
-        auto mask = wide->values.size() - 1;
-        auto i = 0;
-        while (i < source->values.size()) {
-            auto _node = source->values[i];
-            if (!_node) {
+        auto n = source.size();
+        for (auto i = 0; i < n; i++) {
+            auto u = source.slots()[i];
+            if (!u) {
                 // skip empty node
-            } else if (_node->is_leaf()) {
-                auto sn = new node(
-                    _node->hash,
-                    _node->key,
-                    _node->value
-                );
-                auto pos = (_node->hash >> level) & mask;
-                if (!wide->values[pos])
-                    wide->values[pos] = sn;
+            } else if (u.is_leaf()) {
+                auto sn = raw_cast<leaf>(u);
+                auto pos = (sn->hash >> level) & (16 - 1);
+                if (!an->values[pos])
+                    an->values[pos] = raw_ptr{sn};
                 else
-                    sequential_insert(sn, wide, level, pos);
+                    sequential_insert(sn, an, level, pos);
             } else {
-                sequential_transfer(_node, wide, level);
+                sequential_transfer(u, an, level);
             }
-            i += 1;
         }
+        delete_anode(source);
     }
 
     auto create_anode(
-        node* sn1,
-        node* sn2,
+        leaf* sn1,
+        leaf* sn2,
         int level
-    ) -> node*
+    ) -> raw_ptr
     {
         auto hash1 = sn1->hash;
         auto hash2 = sn2->hash;
-        if (hash1 == hash2) {
-            // TODO not dealing with same hash yet
-            // TODO throw error now
-            return {};
+        // keys of the same hash share an lnode, so the leaves never collide
+        auto pos1 = (hash1 >> level) & (4 - 1);
+        auto pos2 = (hash2 >> level) & (4 - 1);
+        if (pos1 != pos2) {
+            auto an = new narrow;
+            an->values[pos1] = raw_ptr{sn1};
+            an->values[pos2] = raw_ptr{sn2};
+            return raw_ptr{an};
         } else {
-            auto pos1 = (hash1 >> level) & (4 - 1);
-            auto pos2 = (hash2 >> level) & (4 - 1);
-            if (pos1 != pos2) {
-                auto an = new node(4);
-                an->values[pos1] = sn1;
-                an->values[pos2] = sn2;
-                return an;
-            } else {
-                auto an = new node(16);
-                sequential_insert(sn1, an, level);
-                sequential_insert(sn2, an, level);
-                return an;
-            }
+            auto an = new wide;
+            sequential_insert(sn1, an, level);
+            sequential_insert(sn2, an, level);
+            return raw_ptr{an};
         }
     }
 
     void complete_expansion(
-        node* prev,
+        raw_ptr prev,
         int ppos,
-        node* cur,
+        raw_ptr cur,
         int level
     )
     {
-        auto wide = new node(16);
-        sequential_transfer(cur, wide, level);
-        prev->values[ppos] = wide;
+        auto an = new wide;
+        sequential_transfer(cur, an, level);
+        prev.slots()[ppos] = raw_ptr{an};
     }
 
     void print_prefix(std::string const& prefix) const
@@ -231,95 +498,217 @@ struct raw_trie
             std::cout << "├── ";
     }
 
-    void print_node(node* u) const
+    void print_node(raw_ptr u) const
     {
         if (!u) {
             std::cout << "(empty)\n";
-        } else if (!u->is_leaf()) {
-            std::cout << "(anode, size=" << u->values.size() << ")\n";
+        } else if (!u.is_leaf()) {
+            std::cout << "(anode, size=" << u.size() << ")\n";
+        } else if (raw_cast<leaf>(u)->list) {
+            std::cout << "(lnode, size=" << raw_cast<leaf>(u)->list->count() << ")\n";
         } else {
-            std::cout << "(snode, value=" << u->value << ")\n";
+            std::cout << "(snode, value=" << raw_cast<leaf>(u)->value << ")\n";
         }
     }
 
-    void print(node* u, std::string const& prefix) const
+    void print(raw_ptr u, std::string const& prefix) const
     {
         print_prefix(prefix);
         print_node(u);
-        if (u && !u->is_leaf()) {
-            auto n = u->values.size();
-            for (auto i = 0u; i < n; i++)
-                print(u->values[i], prefix + (i == n - 1 ? ' ' : '|'));
+        if (u && !u.is_leaf()) {
+            auto n = u.size();
+            for (auto i = 0; i < n; i++)
+                print(u.slots()[i], prefix + (i == n - 1 ? ' ' : '|'));
         }
     }
 
     void print() const
     {
-        print(root, {});
+        print(raw_ptr{root}, {});
+    }
+
+    enum stats_kind { anode_4, anode_16, snode_kind, lnode_kind };
+
+    // see util::trie_stats, nothing is ever pending
+    auto stats() const -> util::trie_stats
+    {
+        util::trie_stats s{"anode-4", "anode-16", "snode", "lnode"};
+        s.add(anode_16, sizeof(wide));
+        stats(raw_ptr{root}, 0, s);
+        return s;
+    }
+
+    static void stats(raw_ptr an, int depth, util::trie_stats& s)
+    {
+        auto n = an.size();
+        auto used = 0;
+        for (auto i = 0; i < n; i++) {
+            auto u = an.slots()[i];
+            if (!u)
+                continue;
+            used += 1;
+            if (!u.is_leaf()) {
+                s.add(u.kind() == raw_node::narrow ? anode_4 : anode_16,
+                    u.kind() == raw_node::narrow ? sizeof(narrow) : sizeof(wide));
+                stats(u, depth + 1, s);
+            } else if (auto l = raw_cast<leaf>(u); l->list) {
+                auto size = sizeof(leaf);
+                for (auto b = l->list.get(); b; b = b->next)
+                    size += sizeof(*b);
+                s.add(lnode_kind, size);
+                s.leaf(depth, l->list->count());
+            } else {
+                s.add(snode_kind, sizeof(leaf));
+                s.leaf(depth, 1);
+            }
+        }
+        s.slots(n, used);
     }
 
-    node* root = new node(16);
+    // the trie as a dot graph, written as it is walked
+    void write_dot(std::ostream& os) const
+    {
+        util::dot_writer dot{os};
+        dot.node(root, "anode, size=16");
+        write_dot(dot, raw_ptr{root});
+    }
+
+    static void write_dot(util::dot_writer& dot, raw_ptr an)
+    {
+        auto n = an.size();
+        for (auto i = 0; i < n; i++) {
+            auto u = an.slots()[i];
+            if (!u)
+                continue;
+            if (!u.is_leaf())
+                dot.node(u.address(), "anode, size=", u.size());
+            else if (raw_cast<leaf>(u)->list)
+                dot.node(u.address(), "lnode, size=", raw_cast<leaf>(u)->list->count());
+            else
+                dot.node(u.address(), "snode, value=", raw_cast<leaf>(u)->value);
+            dot.edge(an.address(), u.address(), i);
+            if (!u.is_leaf())
+                write_dot(dot, u);
+        }
+    }
+
+    wide* root = new wide;
+    hasher hash_function;
 };
 
 
-template <class Key, class T, int Size>
+template <class Key, class T, class Hash = util::hash<Key>>
 struct raw_trie_mem_pool
 {
     using key_type   = Key;
     using value_type = T;
-    using hash_type  = int;
+    using hash_type  = util::hash_result_t<Hash, Key>;
+    using hasher     = Hash;
+    using bucket_type = util::bucket<key_type, value_type>;
 
-    struct node
+    struct leaf
     {
-        node() = default;
-        node(hash_type hash, key_type const& key, value_type const& value)
-            : hash(hash), key(key), value(value), _leaf(true) {}
-        node(int size) : _leaf(false), values(size) {}
-
-        auto is_leaf() const { return _leaf; }
+        static constexpr auto kind = raw_node::leaf;
 
         hash_type hash;
         key_type key;
         value_type value;
-        bool _leaf;
+        // set on the lnodes, leaves whose keys share the hash. the leaf owns
+        // the chain, so whatever destroys the leaf frees it
+        std::unique_ptr<bucket_type> list{};
+    };
 
-        std::vector<node*> values;
+    using narrow = raw_anode<4>;
+    using wide = raw_anode<16>;
+
+    // a slab for every size class of node. the narrow anodes an expansion
+    // drops go back to theirs and are taken again by the next one.
+    struct arena
+    {
+        void merge(arena&& other)
+        {
+            leaves.merge(std::move(other.leaves));
+            narrows.merge(std::move(other.narrows));
+            wides.merge(std::move(other.wides));
+        }
+
+        util::slab<leaf> leaves;
+        util::slab<narrow> narrows;
+        util::slab<wide> wides;
     };
 
-    std::vector<node> mem_pool;
-    int alloc{};
-    node* root{new node(16)};
+    arena pool;
+    wide* root{pool.wides.make()};
+    hasher hash_function;
+
+    raw_trie_mem_pool() = default;
 
-    raw_trie_mem_pool()
-        : mem_pool(2 * Size)
+    // room for reserve leaves before the pool grows
+    explicit raw_trie_mem_pool(std::size_t reserve)
     {
+        pool.leaves = util::slab<leaf>{reserve};
+    }
+
+    raw_trie_mem_pool(raw_trie_mem_pool const&) = delete;
+    raw_trie_mem_pool& operator=(raw_trie_mem_pool const&) = delete;
+
+    // the slabs do not destroy what is left in them, so every node is
+    // given back to its slab first
+    ~raw_trie_mem_pool()
+    {
+        clear();
+        pool.wides.free(root);
+    }
+
+    // every node but root goes back to its slab, to be taken again by the
+    // inserts to come, and the slots of root are emptied
+    void clear()
+    {
+        for (auto& u : root->values) {
+            release(u);
+            u = {};
+        }
     }
 
-    auto allocate(hash_type hash, key_type const& key, value_type const& value) -> node*
+    // u and everything below it go back to the slabs of pool
+    void release(raw_ptr u)
     {
-        auto& v = mem_pool[alloc++];
-        v.hash = hash;
-        v.key = key;
-        v.value = value;
-        v._leaf = true;
-        return &v;
+        if (!u)
+            return;
+        if (u.is_leaf()) {
+            pool.leaves.free(raw_cast<leaf>(u));
+            return;
+        }
+        auto n = u.size();
+        for (auto i = 0; i < n; i++)
+            release(u.slots()[i]);
+        if (u.kind() == raw_node::narrow)
+            pool.narrows.free(raw_cast<narrow>(u));
+        else
+            pool.wides.free(raw_cast<wide>(u));
     }
 
     auto lookup(
         key_type const& key,
         hash_type hash,
         int level,
-        node* cur
+        raw_ptr cur
     ) const -> std::optional<value_type>
     {
-        auto pos = (hash >> level) & (cur->values.size() - 1);
-        auto u = cur->values[pos];
+        auto pos = (hash >> level) & (cur.size() - 1);
+        auto u = cur.slots()[pos];
         if (!u) return {};
-        if (!u->is_leaf()) {
+        if (!u.is_leaf()) {
             return lookup(key, hash, level + 4, u);
+        }
+        auto l = raw_cast<leaf>(u);
+        if (l->list) {
+            if (auto v = l->list->find(key))
+                return *v;
+            return {};
         } else {
-            if (u->key == key)
-                return u->value;
+            if (l->key == key)
+                return l->value;
             else
                 return {};
         }
@@ -330,161 +719,251 @@ struct raw_trie_mem_pool
         value_type const& value,
         hash_type hash,
         int level,
-        node* cur,
-        node* prev
+        raw_ptr cur,
+        raw_ptr prev
     )
     {
         // std::cerr << "inserting: hash=" << hash << ", level=" << level << "\n";
-        auto pos = (hash >> level) & ((cur->values).size() - 1);
-        auto u = cur->values[pos];
+        auto pos = (hash >> level) & (cur.size() - 1);
+        auto u = cur.slots()[pos];
         if (!u) {
-            auto v = allocate(hash, key, value);
-            cur->values[pos] = v;
-        } else if (!u->is_leaf()) {
+            auto v = pool.leaves.make(hash, key, value);
+            cur.slots()[pos] = raw_ptr{v};
+        } else if (!u.is_leaf()) {
             insert(key, value, hash, level + 4, u, cur);
         } else {
-            if (u->key == key) {
-                cur->values[pos] = allocate(hash, key, value);
-            } else if (cur->values.size() == 4) {
-                auto ppos = (hash >> (level - 4)) & (prev->values.size() - 1);
+            auto l = raw_cast<leaf>(u);
+            if (l->hash == hash) {
+                if (l->list) {
+                    l->list->assign(key, value);
+                } else if (l->key == key) {
+                    // nothing else holds the leaf, a new one would only
+                    // cost a trip through the free list
+                    l->value = value;
+                } else {
+                    // the first collision of the full hash makes l an lnode
+                    l->list = std::make_unique<bucket_type>();
+                    l->list->assign(l->key, l->value);
+                    l->list->assign(key, value);
+                }
+            } else if (cur.kind() == raw_node::narrow) {
+                auto ppos = (hash >> (level - 4)) & (prev.size() - 1);
                 complete_expansion(prev, ppos, cur, level);
-                insert(key, value, hash, level, prev->values[ppos], prev);
+                insert(key, value, hash, level, prev.slots()[ppos], prev);
             } else {
-                auto sn = allocate(hash, key, value);
-                auto an = create_anode(u, sn, level + 4);
-                cur->values[pos] = an;
+                auto sn = pool.leaves.make(hash, key, value);
+                auto an = create_anode(l, sn, level + 4, pool);
+                cur.slots()[pos] = an;
             }
         }
     }
 
+    auto hash(key_type const& key) const -> hash_type
+    {
+        return static_cast<hash_type>(hash_function(key));
+    }
+
+    auto lookup(key_type const& key) const -> std::optional<value_type>
+    {
+        return lookup(key, hash(key), 0, raw_ptr{root});
+    }
+
+    void insert(key_type const& key, value_type const& value)
+    {
+        insert(key, value, hash(key));
+    }
+
     void insert(key_type const& key, value_type const& value, hash_type hash)
     {
-        insert(key, value, hash, 0, root, nullptr);
+        insert(key, value, hash, 0, raw_ptr{root}, raw_ptr{});
+    }
+
+    // like raw_trie::bulk_load. every root slot is built from an arena of
+    // its own, so that the threads do not share the slabs, and the arenas
+    // are merged into pool before the plain inserts into slots that hold
+    // keys already.
+    template <class Range>
+    void bulk_load(Range const& items, int threads = util::hardware_threads())
+    {
+        auto first = std::begin(items);
+        auto n = static_cast<std::size_t>(std::distance(first, std::end(items)));
+        util::hashed_batch<hash_type> batch{n, [&](std::size_t i) {
+            auto const& [key, value] = first[i];
+            return hash(key);
+        }, threads};
+        std::vector<arena> parts(batch.slots);
+        bool taken[decltype(batch)::slots]{};
+        util::parallel_tasks(threads, batch.slots, [&](int s) {
+            if (root->values[s]) {
+                taken[s] = true;
+                return;
+            }
+            wide holder;
+            batch.for_each_run(s, [&](std::size_t i, std::size_t j) {
+                sequential_insert(bulk_leaf(batch, first, i, j, parts[s]), &holder, 0, parts[s]);
+            });
+            root->values[s] = holder.values[s];
+        });
+        for (auto& part : parts)
+            pool.merge(std::move(part));
+        for (auto s = 0; s < batch.slots; s++) {
+            if (!taken[s])
+                continue;
+            for (auto i = batch.begin(s); i < batch.end(s); i++) {
+                auto const& [key, value] = first[batch.entries[i].second];
+                insert(key, value, batch.entries[i].first);
+            }
+        }
+    }
+
+    // like raw_trie::bulk_leaf, with the leaf from a
+    template <class Batch, class Iterator>
+    static auto bulk_leaf(
+        Batch const& batch,
+        Iterator first,
+        std::size_t i,
+        std::size_t j,
+        arena& a
+    ) -> leaf*
+    {
+        std::unique_ptr<bucket_type> list;
+        if (j - i > 1) {
+            list = std::make_unique<bucket_type>();
+            for (auto k = i; k < j; k++) {
+                auto const& [key, value] = first[batch.entries[k].second];
+                list->assign(key, value);
+            }
+            if (list->count() == 1)
+                list.reset();
+        }
+        auto const& [key, value] = first[batch.entries[j - 1].second];
+        return a.leaves.make(batch.entries[i].first, key, value, std::move(list));
     }
 
-    // TODO key_type = value_type = hash_type
-    void debug_insert(hash_type hash)
+    // TODO key_type = value_type
+    void debug_insert(key_type const& key)
     {
-        insert(hash, hash, hash);
+        insert(key, key);
     }
 
-    // TODO key_type = value_type = hash_type
-    void debug_lookup(hash_type hash) const
+    // TODO key_type = value_type
+    void debug_lookup(key_type const& key) const
     {
-        std::cout << "lookup[" << hash << "] = ";
-        auto res = lookup(hash, hash, 0, root);
+        std::cout << "lookup[" << key << "] = ";
+        auto res = lookup(key);
         if (res)
             std::cout << *res << "\n";
         else
             std::cout << "null\n";
     }
 
+    // the anodes below come from a, and the ones dropped go back to it
     void sequential_insert(
-        node* sn,
-        node* wide,
-        int level
+        leaf* sn,
+        wide* an,
+        int level,
+        arena& a
     )
     {
-        auto mask = wide->values.size() - 1;
-        auto pos = (sn->hash >> level) & mask;
-        if (!wide->values[pos])
-            wide->values[pos] = sn;
+        auto pos = (sn->hash >> level) & (16 - 1);
+        if (!an->values[pos])
+            an->values[pos] = raw_ptr{sn};
         else
-            sequential_insert(sn, wide, level, pos);
+            sequential_insert(sn, an, level, pos, a);
     }
 
     void sequential_insert(
-        node* sn,
-        node* wide,
+        leaf* sn,
+        wide* an,
         int level,
-        int pos
+        int pos,
+        arena& a
     )
     {
-        auto u = wide->values[pos];
-        if (u->is_leaf()) {
-            auto an = create_anode(sn, u, level + 4);
-            wide->values[pos] = an;
+        auto u = an->values[pos];
+        if (u.is_leaf()) {
+            an->values[pos] = create_anode(sn, raw_cast<leaf>(u), level + 4, a);
         } else {
-            auto mask = u->values.size() - 1;
-            auto npos = (sn->hash >> (level + 4)) & mask;
-            if (!u->values[npos]) {
-                u->values[npos] = sn;
-            } else if (u->values.size() == 4) {
-                auto an = new node(16);
-                sequential_transfer(u, an, level + 4);
-                wide->values[pos] = an;
-                sequential_insert(sn, wide, level, pos);
+            auto npos = (sn->hash >> (level + 4)) & (u.size() - 1);
+            if (!u.slots()[npos]) {
+                u.slots()[npos] = raw_ptr{sn};
+            } else if (u.kind() == raw_node::narrow) {
+                auto w = a.wides.make();
+                sequential_transfer(u, w, level + 4, a);
+                an->values[pos] = raw_ptr{w};
+                sequential_insert(sn, an, level, pos, a);
             } else {
-                sequential_insert(sn, u, level + 4, npos);
+                sequential_insert(sn, raw_cast<wide>(u), level + 4, npos, a);
             }
         }
     }
 
+    // the leaves below source move to an, source and the anodes below it
+    // are freed
     void sequential_transfer(
-        node* source,
-        node* wide,
-        int level
+        raw_ptr source,
+        wide* an,
+        int level,
+        arena& a
     )
     {
-        auto mask = wide->values.size() - 1;
-        auto i = 0;
-        while (i < source->values.size()) {
-            auto _node = source->values[i];
-            if (!_node) {
+        auto n = source.size();
+        for (auto i = 0; i < n; i++) {
+            auto u = source.slots()[i];
+            if (!u) {
                 // skip empty node
-            } else if (_node->is_leaf()) {
-                auto sn = allocate(_node->hash, _node->key, _node->value);
-                auto pos = (_node->hash >> level) & mask;
-                if (!wide->values[pos])
-                    wide->values[pos] = sn;
+            } else if (u.is_leaf()) {
+                auto sn = raw_cast<leaf>(u);
+                auto pos = (sn->hash >> level) & (16 - 1);
+                if (!an->values[pos])
+                    an->values[pos] = raw_ptr{sn};
                 else
-                    sequential_insert(sn, wide, level, pos);
+                    sequential_insert(sn, an, level, pos, a);
             } else {
-                sequential_transfer(_node, wide, level);
+                sequential_transfer(u, an, level, a);
             }
-            i += 1;
         }
+        if (source.kind() == raw_node::narrow)
+            a.narrows.free(raw_cast<narrow>(source));
+        else
+            a.wides.free(raw_cast<wide>(source));
     }
 
     auto create_anode(
-        node* sn1,
-        node* sn2,
-        int level
-    ) -> node*
+        leaf* sn1,
+        leaf* sn2,
+        int level,
+        arena& a
+    ) -> raw_ptr
     {
         auto hash1 = sn1->hash;
         auto hash2 = sn2->hash;
-        if (hash1 == hash2) {
-            // TODO not dealing with same hash yet
-            // TODO throw error now
-            return {};
+        // keys of the same hash share an lnode, so the leaves never collide
+        auto pos1 = (hash1 >> level) & (4 - 1);
+        auto pos2 = (hash2 >> level) & (4 - 1);
+        if (pos1 != pos2) {
+            auto an = a.narrows.make();
+            an->values[pos1] = raw_ptr{sn1};
+            an->values[pos2] = raw_ptr{sn2};
+            return raw_ptr{an};
         } else {
-            auto pos1 = (hash1 >> level) & (4 - 1);
-            auto pos2 = (hash2 >> level) & (4 - 1);
-            if (pos1 != pos2) {
-                auto an = new node(4);
-                an->values[pos1] = sn1;
-                an->values[pos2] = sn2;
-                return an;
-            } else {
-                auto an = new node(16);
-                sequential_insert(sn1, an, level);
-                sequential_insert(sn2, an, level);
-                return an;
-            }
+            auto an = a.wides.make();
+            sequential_insert(sn1, an, level, a);
+            sequential_insert(sn2, an, level, a);
+            return raw_ptr{an};
         }
     }
 
     void complete_expansion(
-        node* prev,
+        raw_ptr prev,
         int ppos,
-        node* cur,
+        raw_ptr cur,
         int level
     )
     {
-        auto wide = new node(16);
-        sequential_transfer(cur, wide, level);
-        prev->values[ppos] = wide;
+        auto an = pool.wides.make();
+        sequential_transfer(cur, an, level, pool);
+        prev.slots()[ppos] = raw_ptr{an};
     }
 
     void print_prefix(std::string const& prefix) const
@@ -501,31 +980,107 @@ struct raw_trie_mem_pool
             std::cout << "├── ";
     }
 
-    void print_node(node* u) const
+    void print_node(raw_ptr u) const
     {
         if (!u) {
             std::cout << "(empty)\n";
-        } else if (!u->is_leaf()) {
-            std::cout << "(anode, size=" << u->values.size() << ")\n";
+        } else if (!u.is_leaf()) {
+            std::cout << "(anode, size=" << u.size() << ")\n";
+        } else if (raw_cast<leaf>(u)->list) {
+            std::cout << "(lnode, size=" << raw_cast<leaf>(u)->list->count() << ")\n";
         } else {
-            std::cout << "(snode, value=" << u->value << ")\n";
+            std::cout << "(snode, value=" << raw_cast<leaf>(u)->value << ")\n";
         }
     }
 
-    void print(node* u, std::string const& prefix) const
+    void print(raw_ptr u, std::string const& prefix) const
     {
         print_prefix(prefix);
         print_node(u);
-        if (u && !u->is_leaf()) {
-            auto n = u->values.size();
-            for (auto i = 0u; i < n; i++)
-                print(u->values[i], prefix + (i == n - 1 ? ' ' : '|'));
+        if (u && !u.is_leaf()) {
+            auto n = u.size();
+            for (auto i = 0; i < n; i++)
+                print(u.slots()[i], prefix + (i == n - 1 ? ' ' : '|'));
         }
     }
 
     void print() const
     {
-        print(root, {});
+        print(raw_ptr{root}, {});
+    }
+
+    enum stats_kind { anode_4, anode_16, snode_kind, lnode_kind };
+
+    // see util::trie_stats, bytes are what the slabs hold and
+    // pending their free slots
+    auto stats() const -> util::trie_stats
+    {
+        util::trie_stats s{"anode-4", "anode-16", "snode", "lnode"};
+        s.add(anode_16, sizeof(wide));
+        stats(raw_ptr{root}, 0, s);
+        auto free = [&](auto const& slab, std::size_t size) {
+            auto n = slab.capacity() - slab.size();
+            s.bytes += n * size;
+            s.pending += n;
+        };
+        free(pool.leaves, sizeof(leaf));
+        free(pool.narrows, sizeof(narrow));
+        free(pool.wides, sizeof(wide));
+        return s;
+    }
+
+    static void stats(raw_ptr an, int depth, util::trie_stats& s)
+    {
+        auto n = an.size();
+        auto used = 0;
+        for (auto i = 0; i < n; i++) {
+            auto u = an.slots()[i];
+            if (!u)
+                continue;
+            used += 1;
+            if (!u.is_leaf()) {
+                s.add(u.kind() == raw_node::narrow ? anode_4 : anode_16,
+                    u.kind() == raw_node::narrow ? sizeof(narrow) : sizeof(wide));
+                stats(u, depth + 1, s);
+            } else if (auto l = raw_cast<leaf>(u); l->list) {
+                auto size = sizeof(leaf);
+                for (auto b = l->list.get(); b; b = b->next)
+                    size += sizeof(*b);
+                s.add(lnode_kind, size);
+                s.leaf(depth, l->list->count());
+            } else {
+                s.add(snode_kind, sizeof(leaf));
+                s.leaf(depth, 1);
+            }
+        }
+        s.slots(n, used);
+    }
+
+    // the trie as a dot graph, written as it is walked
+    void write_dot(std::ostream& os) const
+    {
+        util::dot_writer dot{os};
+        dot.node(root, "anode, size=16");
+        write_dot(dot, raw_ptr{root});
+    }
+
+    static void write_dot(util::dot_writer& dot, raw_ptr an)
+    {
+        auto n = an.size();
+        for (auto i = 0; i < n; i++) {
+            auto u = an.slots()[i];
+            if (!u)
+                continue;
+            if (!u.is_leaf())
+                dot.node(u.address(), "anode, size=", u.size());
+            else if (raw_cast<leaf>(u)->list)
+                dot.node(u.address(), "lnode, size=", raw_cast<leaf>(u)->list->count());
+            else
+                dot.node(u.address(), "snode, value=", raw_cast<leaf>(u)->value);
+            dot.edge(an.address(), u.address(), i);
+            if (!u.is_leaf())
+                write_dot(dot, u);
+        }
     }
 };
 
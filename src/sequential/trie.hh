@@ -4,16 +4,24 @@
 #include <string>
 #include <memory>
 #include <optional>
+#include <iterator>
+#include "../util/bucket.hh"
+#include "../util/bulk.hh"
+#include "../util/hash.hh"
+#include "../util/stats.hh"
+#include "../util/image.hh"
 
 namespace sequential
 {
 
-template <class Key, class T>
+template <class Key, class T, class Hash = util::hash<Key>>
 struct trie
 {
     using key_type   = Key;
     using value_type = T;
-    using hash_type  = int;
+    using hash_type  = util::hash_result_t<Hash, Key>;
+    using hasher     = Hash;
+    using bucket_type = util::bucket<key_type, value_type>;
 
     struct node
     {
@@ -28,6 +36,8 @@ struct trie
         key_type key;
         value_type value;
         std::vector<std::shared_ptr<node>> values;
+        // set on the lnodes, leaves whose keys share the hash
+        std::unique_ptr<bucket_type> list;
     };
 
     auto lookup(
@@ -42,6 +52,10 @@ struct trie
         if (!u) return {};
         if (!u->is_leaf()) {
             return lookup(key, hash, level + 4, u);
+        } else if (u->list) {
+            if (auto v = u->list->find(key))
+                return *v;
+            return {};
         } else {
             if (u->key == key)
                 return u->value;
@@ -68,8 +82,17 @@ struct trie
         } else if (!u->is_leaf()) {
             insert(key, value, hash, level + 4, u, cur);
         } else {
-            if (u->key == key) {
-                cur->values[pos] = std::make_shared<node>(hash, key, value);
+            if (u->hash == hash) {
+                if (u->list) {
+                    u->list->assign(key, value);
+                } else if (u->key == key) {
+                    cur->values[pos] = std::make_shared<node>(hash, key, value);
+                } else {
+                    // the first collision of the full hash makes u an lnode
+                    u->list = std::make_unique<bucket_type>();
+                    u->list->assign(u->key, u->value);
+                    u->list->assign(key, value);
+                }
             } else if (cur->values.size() == 4) {
                 auto ppos = (hash >> (level - 4)) & (prev->values.size() - 1);
                 complete_expansion(prev, ppos, cur, level);
@@ -82,22 +105,90 @@ struct trie
         }
     }
 
+    auto hash(key_type const& key) const -> hash_type
+    {
+        return static_cast<hash_type>(hash_function(key));
+    }
+
+    auto lookup(key_type const& key) const -> std::optional<value_type>
+    {
+        return lookup(key, hash(key), 0, root);
+    }
+
+    void insert(key_type const& key, value_type const& value)
+    {
+        insert(key, value, hash(key));
+    }
+
     void insert(key_type const& key, value_type const& value, hash_type hash)
     {
         insert(key, value, hash, 0, root, nullptr);
     }
 
-    // TODO key_type = value_type = hash_type
-    void debug_insert(hash_type hash)
+    // the pairs of items, a random access range, as if they were inserted in
+    // order, on threads threads. the batch is split by root slot, see
+    // util::hashed_batch, and the subtree of every empty root slot is built
+    // apart by sequential_insert, then stored into root. slots that hold
+    // keys already get plain inserts.
+    template <class Range>
+    void bulk_load(Range const& items, int threads = util::hardware_threads())
+    {
+        auto first = std::begin(items);
+        auto n = static_cast<std::size_t>(std::distance(first, std::end(items)));
+        util::hashed_batch<hash_type> batch{n, [&](std::size_t i) {
+            auto const& [key, value] = first[i];
+            return hash(key);
+        }, threads};
+        util::parallel_tasks(threads, batch.slots, [&](int s) {
+            if (!root->values[s]) {
+                auto holder{std::make_shared<node>(16)};
+                batch.for_each_run(s, [&](std::size_t i, std::size_t j) {
+                    sequential_insert(bulk_leaf(batch, first, i, j), holder, 0);
+                });
+                root->values[s] = std::move(holder->values[s]);
+                return;
+            }
+            for (auto i = batch.begin(s); i < batch.end(s); i++) {
+                auto const& [key, value] = first[batch.entries[i].second];
+                insert(key, value, batch.entries[i].first);
+            }
+        });
+    }
+
+    // the leaf of the pairs of the entries [i, j) of batch, which share a
+    // hash: the last pair, with a list if there is more than one key among
+    // them.
+    template <class Batch, class Iterator>
+    static auto bulk_leaf(Batch const& batch, Iterator first, std::size_t i, std::size_t j)
+        -> std::shared_ptr<node>
+    {
+        std::unique_ptr<bucket_type> list;
+        if (j - i > 1) {
+            list = std::make_unique<bucket_type>();
+            for (auto k = i; k < j; k++) {
+                auto const& [key, value] = first[batch.entries[k].second];
+                list->assign(key, value);
+            }
+            if (list->count() == 1)
+                list.reset();
+        }
+        auto const& [key, value] = first[batch.entries[j - 1].second];
+        auto leaf{std::make_shared<node>(batch.entries[i].first, key, value)};
+        leaf->list = std::move(list);
+        return leaf;
+    }
+
+    // TODO key_type = value_type
+    void debug_insert(key_type const& key)
     {
-        insert(hash, hash, hash);
+        insert(key, key);
     }
 
-    // TODO key_type = value_type = hash_type
-    void debug_lookup(hash_type hash) const
+    // TODO key_type = value_type
+    void debug_lookup(key_type const& key) const
     {
-        std::cout << "lookup[" << hash << "] = ";
-        auto res = lookup(hash, hash, 0, root);
+        std::cout << "lookup[" << key << "] = ";
+        auto res = lookup(key);
         if (res)
             std::cout << *res << "\n";
         else
@@ -158,11 +249,12 @@ struct trie
             if (!_node) {
                 // skip empty node
             } else if (_node->is_leaf()) {
-                auto sn{std::make_shared<node>(
+                // lnodes are moved, there is no point in copying the bucket
+                auto sn = _node->list ? _node : std::make_shared<node>(
                     _node->hash,
                     _node->key,
                     _node->value
-                )};
+                );
                 auto pos = (_node->hash >> level) & mask;
                 if (!wide->values[pos])
                     wide->values[pos] = sn;
@@ -183,24 +275,19 @@ struct trie
     {
         auto hash1 = sn1->hash;
         auto hash2 = sn2->hash;
-        if (hash1 == hash2) {
-            // TODO not dealing with same hash yet
-            // TODO throw error now
-            return {};
+        // keys of the same hash share an lnode, so the leaves never collide
+        auto pos1 = (hash1 >> level) & (4 - 1);
+        auto pos2 = (hash2 >> level) & (4 - 1);
+        if (pos1 != pos2) {
+            auto an{std::make_shared<node>(4)};
+            an->values[pos1] = sn1;
+            an->values[pos2] = sn2;
+            return an;
         } else {
-            auto pos1 = (hash1 >> level) & (4 - 1);
-            auto pos2 = (hash2 >> level) & (4 - 1);
-            if (pos1 != pos2) {
-                auto an{std::make_shared<node>(4)};
-                an->values[pos1] = sn1;
-                an->values[pos2] = sn2;
-                return an;
-            } else {
-                auto an{std::make_shared<node>(16)};
-                sequential_insert(sn1, an, level);
-                sequential_insert(sn2, an, level);
-                return an;
-            }
+            auto an{std::make_shared<node>(16)};
+            sequential_insert(sn1, an, level);
+            sequential_insert(sn2, an, level);
+            return an;
         }
     }
 
@@ -236,6 +323,8 @@ struct trie
             std::cout << "(empty)\n";
         } else if (!u->is_leaf()) {
             std::cout << "(anode, size=" << u->values.size() << ")\n";
+        } else if (u->list) {
+            std::cout << "(lnode, size=" << u->list->count() << ")\n";
         } else {
             std::cout << "(snode, value=" << u->value << ")\n";
         }
@@ -257,7 +346,99 @@ struct trie
         print(root, {});
     }
 
+    enum stats_kind { anode_4, anode_16, snode_kind, lnode_kind };
+
+    // the control block make_shared keeps with a node, in libstdc++
+    static constexpr std::size_t shared_bytes = sizeof(void*) + 2 * sizeof(int);
+
+    // see util::trie_stats, nothing is ever pending
+    auto stats() const -> util::trie_stats
+    {
+        util::trie_stats s{"anode-4", "anode-16", "snode", "lnode"};
+        stats(root, 0, s);
+        return s;
+    }
+
+    void stats(std::shared_ptr<node> const& an, int depth, util::trie_stats& s) const
+    {
+        auto n = static_cast<int>(an->values.size());
+        auto used = 0;
+        s.add(n == 4 ? anode_4 : anode_16,
+            sizeof(node) + shared_bytes + an->values.capacity() * sizeof(std::shared_ptr<node>));
+        for (auto const& u : an->values) {
+            if (!u)
+                continue;
+            used += 1;
+            if (!u->is_leaf()) {
+                stats(u, depth + 1, s);
+            } else if (u->list) {
+                auto size = sizeof(node) + shared_bytes;
+                for (auto b = u->list.get(); b; b = b->next)
+                    size += sizeof(*b);
+                s.add(lnode_kind, size);
+                s.leaf(depth, u->list->count());
+            } else {
+                s.add(snode_kind, sizeof(node) + shared_bytes);
+                s.leaf(depth, 1);
+            }
+        }
+        s.slots(n, used);
+    }
+
+    // the trie as a dot graph, written as it is walked
+    void write_dot(std::ostream& os) const
+    {
+        util::dot_writer dot{os};
+        dot.node(root.get(), "anode, size=", root->values.size());
+        write_dot(dot, root);
+    }
+
+    void write_dot(util::dot_writer& dot, std::shared_ptr<node> const& an) const
+    {
+        for (auto i = 0u; i < an->values.size(); i++) {
+            auto const& u = an->values[i];
+            if (!u)
+                continue;
+            if (!u->is_leaf())
+                dot.node(u.get(), "anode, size=", u->values.size());
+            else if (u->list)
+                dot.node(u.get(), "lnode, size=", u->list->count());
+            else
+                dot.node(u.get(), "snode, value=", u->value);
+            dot.edge(an.get(), u.get(), i);
+            if (!u->is_leaf())
+                write_dot(dot, u);
+        }
+    }
+
+    // the trie as an image file, see util::image and util::mapped_trie.
+    // false if the file could not be written, errno says why.
+    auto save(std::string const& path) const -> bool
+    {
+        util::image::writer<key_type, value_type, hash_type> w{path};
+        return w.finish(save(w, root));
+    }
+
+    template <class Writer>
+    static auto save(Writer& w, std::shared_ptr<node> const& an) -> std::uint64_t
+    {
+        std::uint64_t slots[16] = {};
+        for (auto i = 0u; i < an->values.size(); i++) {
+            auto const& u = an->values[i];
+            if (!u)
+                continue;
+            if (!u->is_leaf())
+                slots[i] = save(w, u);
+            else if (u->list)
+                slots[i] = w.bucket(u->hash, *u->list);
+            else
+                slots[i] = w.leaf(u->hash, u->key, u->value);
+        }
+        return w.anode(slots, an->values.size());
+    }
+
     std::shared_ptr<node> root{std::make_shared<node>(16)};
+    hasher hash_function;
 };
 
 } // namespace concurrent
@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+
+// the heap allocations of a bench, counted by replacing the global operator
+// new and delete, plain, array and aligned alike. replacements cannot be
+// inline, so only the one translation unit of a bench includes this. they
+// are kept out of line, or gcc sees malloc and free through new and delete
+// and takes them for a mismatch.
+
+namespace util
+{
+
+// the calls to operator new so far, and the bytes they asked for
+inline std::atomic<long> allocations{0};
+inline std::atomic<long> allocated_bytes{0};
+
+namespace detail
+{
+
+[[gnu::noinline]] inline auto counted_alloc(std::size_t size, std::size_t align) -> void*
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(static_cast<long>(size), std::memory_order_relaxed);
+    if (align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        if (auto p = std::malloc(size ? size : 1))
+            return p;
+    } else {
+        // aligned_alloc takes multiples of the alignment only
+        if (auto p = std::aligned_alloc(align, (size + align - 1) / align * align))
+            return p;
+    }
+    throw std::bad_alloc{};
+}
+
+[[gnu::noinline]] inline void counted_free(void* p) noexcept
+{
+    std::free(p);
+}
+
+} // namespace detail
+
+} // namespace util
+
+[[gnu::noinline]] void* operator new(std::size_t size)
+{
+    return util::detail::counted_alloc(size, 0);
+}
+
+[[gnu::noinline]] void* operator new[](std::size_t size)
+{
+    return util::detail::counted_alloc(size, 0);
+}
+
+[[gnu::noinline]] void* operator new(std::size_t size, std::align_val_t align)
+{
+    return util::detail::counted_alloc(size, static_cast<std::size_t>(align));
+}
+
+[[gnu::noinline]] void* operator new[](std::size_t size, std::align_val_t align)
+{
+    return util::detail::counted_alloc(size, static_cast<std::size_t>(align));
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept { util::detail::counted_free(p); }
+[[gnu::noinline]] void operator delete[](void* p) noexcept { util::detail::counted_free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept { util::detail::counted_free(p); }
+[[gnu::noinline]] void operator delete[](void* p, std::size_t) noexcept { util::detail::counted_free(p); }
+
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t) noexcept
+{
+    util::detail::counted_free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void* p, std::align_val_t) noexcept
+{
+    util::detail::counted_free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    util::detail::counted_free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void* p, std::size_t, std::align_val_t) noexcept
+{
+    util::detail::counted_free(p);
+}
@@ -5,22 +5,25 @@
 #include <algorithm>
 #include <numeric>
 #include "timer.hh"
+#include "perf.hh"
 
 namespace util
 {
 
 template <class T>
-auto bench_insert_onne(T& a, int size)
+auto bench_insert_onne(T& a, int size, perf_counters& counters)
 {
     std::vector<int> v(size);
     std::iota(v.begin(), v.end(), 0);
     std::random_shuffle(v.begin(), v.end());
 
     util::timer t;
+    counters.start();
     t.start();
     for (auto i : v)
         a.debug_insert(i);
     t.stop();
+    counters.stop();
 
     return t.elapsed_milliseconds();
 }
@@ -28,12 +31,14 @@ auto bench_insert_onne(T& a, int size)
 template <class T>
 auto bench_insert(int size, int repeat = 20, std::string const& name = "")
 {
+    perf_counters counters;
     // warmup
     double warm_sum_time = 0;
     for (auto i = 0; i < 4; i++) {
         T a{};
-        warm_sum_time += bench_insert_onne(a, size);
+        warm_sum_time += bench_insert_onne(a, size, counters);
     }
+    counters.reset();
 
     std::cout << "testing [" << name << "]\n";
     std::cout << "warm avg: " << warm_sum_time/4 << "\n";
@@ -41,11 +46,12 @@ auto bench_insert(int size, int repeat = 20, std::string const& name = "")
     double sum_time = 0;
     for (auto i = 0; i < repeat; i++) {
         T a{};
-        sum_time += bench_insert_onne(a, size);
+        sum_time += bench_insert_onne(a, size, counters);
     }
     auto res = sum_time / repeat;
     std::cout << "random insert [" << size << "] elements, time "
         << res << "ms\n";
+    counters.print(std::cout, static_cast<double>(size) * repeat);
     std::cout << std::string(80, '=') << "\n";
     return res;
 }
@@ -0,0 +1,159 @@
+#pragma once
+#include <type_traits>
+#include <cstdint>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace util
+{
+
+// the entries of keys that share one full hash, the lnodes of the tries. keys
+// and values live in separate inline arrays, so that looking a key up
+// compares it against the whole bucket at once: integral keys of four or
+// eight bytes take a few vector compares and no branches, other keys a plain
+// loop. collisions of a full hash are rare, a full bucket continues in next.
+template <class Key, class T, int Capacity = 8>
+struct bucket
+{
+    static_assert(Capacity % 4 == 0 && Capacity < 32);
+
+    using key_type   = Key;
+    using value_type = T;
+
+    static constexpr int capacity = Capacity;
+
+    bucket() = default;
+
+    bucket(bucket const& other)
+        : size(other.size), next(other.next ? new bucket(*other.next) : nullptr)
+    {
+        for (auto i = 0; i < size; i++) {
+            keys[i] = other.keys[i];
+            values[i] = other.values[i];
+        }
+    }
+
+    bucket& operator=(bucket const&) = delete;
+
+    ~bucket() { delete next; }
+
+    // bit i is set if the i-th key of this bucket equals key
+    auto match(key_type const& key) const -> unsigned
+    {
+#if defined(__SSE2__)
+        if constexpr (std::is_integral_v<key_type> && sizeof(key_type) == 4) {
+            auto k = _mm_set1_epi32(static_cast<std::int32_t>(key));
+            unsigned mask = 0;
+            for (auto i = 0; i < Capacity; i += 4) {
+                auto v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(keys + i));
+                auto eq = _mm_castsi128_ps(_mm_cmpeq_epi32(v, k));
+                mask |= static_cast<unsigned>(_mm_movemask_ps(eq)) << i;
+            }
+            return mask & live();
+        } else if constexpr (std::is_integral_v<key_type> && sizeof(key_type) == 8) {
+            auto k = _mm_set1_epi64x(static_cast<std::int64_t>(key));
+            unsigned mask = 0;
+            for (auto i = 0; i < Capacity; i += 2) {
+                auto v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(keys + i));
+                // both halves of a lane have to be equal
+                auto eq = _mm_cmpeq_epi32(v, k);
+                eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+                mask |= static_cast<unsigned>(_mm_movemask_pd(_mm_castsi128_pd(eq))) << i;
+            }
+            return mask & live();
+        }
+#endif
+        unsigned mask = 0;
+        for (auto i = 0; i < size; i++)
+            mask |= static_cast<unsigned>(keys[i] == key) << i;
+        return mask;
+    }
+
+    auto index(key_type const& key) const -> int
+    {
+        auto mask = match(key);
+        return mask ? __builtin_ctz(mask) : -1;
+    }
+
+    auto find(key_type const& key) const -> value_type const*
+    {
+        for (auto b = this; b; b = b->next)
+            if (auto i = b->index(key); i >= 0)
+                return &b->values[i];
+        return nullptr;
+    }
+
+    // number of entries over the whole chain
+    auto count() const -> int
+    {
+        auto n = 0;
+        for (auto b = this; b; b = b->next)
+            n += b->size;
+        return n;
+    }
+
+    // insert or update
+    void assign(key_type const& key, value_type const& value)
+    {
+        auto b = this;
+        while (true) {
+            if (auto i = b->index(key); i >= 0) {
+                b->values[i] = value;
+                return;
+            }
+            if (!b->next)
+                break;
+            b = b->next;
+        }
+        if (b->size == Capacity)
+            b = b->next = new bucket;
+        b->keys[b->size] = key;
+        b->values[b->size] = value;
+        b->size += 1;
+    }
+
+    // the last entry of the chain fills the hole, so that only the last
+    // bucket is ever partly filled. returns false if key is not there.
+    auto erase(key_type const& key) -> bool
+    {
+        auto b = this;
+        auto i = -1;
+        for (; b; b = b->next)
+            if ((i = b->index(key)) >= 0)
+                break;
+        if (!b)
+            return false;
+        bucket* prev = nullptr;
+        auto last = this;
+        while (last->next) {
+            prev = last;
+            last = last->next;
+        }
+        last->size -= 1;
+        b->keys[i] = last->keys[last->size];
+        b->values[i] = last->values[last->size];
+        if (!last->size && prev) {
+            prev->next = nullptr;
+            delete last;
+        }
+        return true;
+    }
+
+    template <class F>
+    void for_each(F&& f) const
+    {
+        for (auto b = this; b; b = b->next)
+            for (auto i = 0; i < b->size; i++)
+                f(b->keys[i], b->values[i]);
+    }
+
+    auto live() const -> unsigned { return (1u << size) - 1; }
+
+    int size{0};
+    key_type keys[Capacity]{};
+    value_type values[Capacity]{};
+    bucket* next{nullptr};
+};
+
+} // namespace util
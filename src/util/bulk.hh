@@ -0,0 +1,117 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <utility>
+#include <cstddef>
+
+namespace util
+{
+
+// the parts of a bulk load the tries share: hashing a batch of key value
+// pairs and splitting it by the root slot of every key, both on as many
+// threads as the load is given. a trie then builds the subtree of every root
+// slot on its own, see bulk_load of the tries.
+
+inline auto hardware_threads() -> int
+{
+    return static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+}
+
+// fn(id) on threads threads, the calling thread is id 0
+template <class F>
+void parallel(int threads, F&& fn)
+{
+    std::vector<std::thread> workers;
+    for (auto id = 1; id < threads; id++)
+        workers.emplace_back([&fn, id] { fn(id); });
+    fn(0);
+    for (auto& th : workers)
+        th.join();
+}
+
+// fn(task) for every task in [0, tasks), taken in turn by threads threads
+template <class F>
+void parallel_tasks(int threads, int tasks, F&& fn)
+{
+    std::atomic<int> next{0};
+    parallel(std::min(threads, tasks), [&](int) {
+        for (auto task = next++; task < tasks; task = next++)
+            fn(task);
+    });
+}
+
+// a batch of n pairs as (hash, index) entries, grouped by the lowest Bits
+// bits of the hash, the root slot of a trie, and sorted by hash and index
+// within a slot, so that keys of equal hashes are adjacent and in the order
+// of the batch. the entries of slot s are [begin(s), end(s)).
+template <class Hash, int Bits = 4>
+struct hashed_batch
+{
+    static constexpr int slots = 1 << Bits;
+
+    using entry = std::pair<Hash, std::size_t>;
+
+    // hash_of(i) is the hash of the i-th pair
+    template <class HashOf>
+    hashed_batch(std::size_t n, HashOf hash_of, int threads)
+        : entries(n)
+    {
+        threads = static_cast<int>(std::max<std::size_t>(1, std::min<std::size_t>(threads, n)));
+        std::vector<entry> hashed(n);
+        // counts[id][s] becomes where thread id scatters its first entry of s
+        std::vector<std::vector<std::size_t>> counts(threads, std::vector<std::size_t>(slots));
+        auto chunk = [&](int id) {
+            return std::pair{n * id / threads, n * (id + 1) / threads};
+        };
+        parallel(threads, [&](int id) {
+            auto [first, last] = chunk(id);
+            for (auto i = first; i < last; i++) {
+                hashed[i] = {static_cast<Hash>(hash_of(i)), i};
+                counts[id][slot(hashed[i].first)] += 1;
+            }
+        });
+        std::size_t sum = 0;
+        for (auto s = 0; s < slots; s++) {
+            starts[s] = sum;
+            for (auto id = 0; id < threads; id++) {
+                auto count = counts[id][s];
+                counts[id][s] = sum;
+                sum += count;
+            }
+        }
+        starts[slots] = sum;
+        parallel(threads, [&](int id) {
+            auto [first, last] = chunk(id);
+            for (auto i = first; i < last; i++)
+                entries[counts[id][slot(hashed[i].first)]++] = hashed[i];
+        });
+        parallel_tasks(threads, slots, [&](int s) {
+            std::sort(entries.begin() + begin(s), entries.begin() + end(s));
+        });
+    }
+
+    static auto slot(Hash hash) -> int { return static_cast<int>(hash & (slots - 1)); }
+
+    auto begin(int s) const { return starts[s]; }
+    auto end(int s) const { return starts[s + 1]; }
+
+    // fn(first, last) for every run of equal hashes of slot s
+    template <class F>
+    void for_each_run(int s, F&& fn) const
+    {
+        for (auto i = begin(s); i < end(s); ) {
+            auto j = i + 1;
+            while (j < end(s) && entries[j].first == entries[i].first)
+                j++;
+            fn(i, j);
+            i = j;
+        }
+    }
+
+    std::vector<entry> entries;
+    std::size_t starts[slots + 1];
+};
+
+} // namespace util
@@ -0,0 +1,190 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <functional>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+namespace util
+{
+
+// hash functions for the tries. a trie consumes the hash four bits at a time
+// from the lowest bits up, so every bit of the result has to depend on every
+// bit of the key, or similar keys pile up in one branch and make it deep.
+
+// the key itself, which is what the tries did before they hashed on their
+// own. keeps sequential keys apart at the top levels but leaves the high bits
+// unused.
+struct identity_hash
+{
+    template <class Key>
+    auto operator()(Key const& key) const -> std::uint64_t
+    {
+        return static_cast<std::uint64_t>(key);
+    }
+};
+
+// one multiply, then the high half folded onto the low half, which is what
+// the low levels of a trie read.
+struct fold_hash
+{
+    auto operator()(std::uint64_t x) const -> std::uint64_t
+    {
+        x *= 0x9e3779b97f4a7c15ull;
+        return x ^ (x >> 32);
+    }
+};
+
+// the multiply-shift finalizer of splitmix64, every output bit depends on
+// every input bit.
+struct mix_hash
+{
+    auto operator()(std::uint64_t x) const -> std::uint64_t
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+};
+
+namespace detail
+{
+
+inline void wymum(std::uint64_t& a, std::uint64_t& b)
+{
+    auto r = static_cast<unsigned __int128>(a) * b;
+    a = static_cast<std::uint64_t>(r);
+    b = static_cast<std::uint64_t>(r >> 64);
+}
+
+inline auto wymix(std::uint64_t a, std::uint64_t b) -> std::uint64_t
+{
+    wymum(a, b);
+    return a ^ b;
+}
+
+inline auto wyr8(unsigned char const* p) -> std::uint64_t
+{
+    std::uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+inline auto wyr4(unsigned char const* p) -> std::uint64_t
+{
+    std::uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+inline auto wyr3(unsigned char const* p, std::size_t k) -> std::uint64_t
+{
+    return (std::uint64_t{p[0]} << 16) | (std::uint64_t{p[k >> 1]} << 8) | p[k - 1];
+}
+
+} // namespace detail
+
+// wyhash (final version 4), reads eight bytes at a time and mixes them with
+// 64x64->128 bit multiplies.
+inline auto wyhash(void const* key, std::size_t len, std::uint64_t seed = 0) -> std::uint64_t
+{
+    using detail::wymix;
+    using detail::wyr8;
+    using detail::wyr4;
+    static constexpr std::uint64_t secret[4]{
+        0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+        0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull,
+    };
+
+    auto p = static_cast<unsigned char const*>(key);
+    seed ^= wymix(seed ^ secret[0], secret[1]);
+    std::uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            auto s = (len >> 3) << 2;
+            a = (wyr4(p) << 32) | wyr4(p + s);
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - s);
+        } else if (len > 0) {
+            a = detail::wyr3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        auto i = len;
+        if (i > 48) {
+            auto see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ secret[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ secret[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    detail::wymum(a, b);
+    return wymix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+struct string_hash
+{
+    auto operator()(std::string_view s) const -> std::uint64_t
+    {
+        return wyhash(s.data(), s.size());
+    }
+};
+
+// the low bits of what Hash returns, for tries on 32 bit hashes
+template <class Hash, class Result = std::uint32_t>
+struct truncate_hash : Hash
+{
+    template <class Key>
+    auto operator()(Key const& key) const -> Result
+    {
+        return static_cast<Result>(Hash::operator()(key));
+    }
+};
+
+// the hash type of a trie is what its Hash returns, made unsigned so that it
+// can be shifted right by any level below its width.
+template <class Hash, class Key>
+using hash_result_t = std::make_unsigned_t<std::invoke_result_t<Hash const&, Key const&>>;
+
+// the default of every trie: mix_hash for integers, wyhash for strings, and
+// std::hash mixed by mix_hash for anything else.
+template <class Key, class = void>
+struct hash
+{
+    auto operator()(Key const& key) const -> std::uint64_t
+    {
+        return mix_hash{}(std::hash<Key>{}(key));
+    }
+};
+
+template <class Key>
+struct hash<Key, std::enable_if_t<std::is_integral_v<Key>>>
+    : mix_hash {};
+
+template <>
+struct hash<std::string> : string_hash {};
+
+template <>
+struct hash<std::string_view> : string_hash {};
+
+} // namespace util
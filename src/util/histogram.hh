@@ -0,0 +1,104 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+
+namespace util
+{
+
+// a log bucketed histogram in the manner of HdrHistogram. values below
+// 2^SubBits have a bucket each, above that every power of two is split into
+// 2^SubBits buckets, so a value is known to within 2^-SubBits of itself, 3%
+// for the default. recording is a few integer instructions and never
+// allocates, so every thread keeps its own histograms and merges them when
+// it is done.
+template <int SubBits = 5>
+struct basic_histogram
+{
+    static constexpr int sub_buckets = 1 << SubBits;
+    static constexpr int groups = 64 - SubBits + 1;
+
+    basic_histogram() : counts(groups * sub_buckets) {}
+
+    static auto index(std::uint64_t v) -> int
+    {
+        if (v < sub_buckets)
+            return static_cast<int>(v);
+        auto e = 63 - __builtin_clzll(v);
+        auto shift = e - SubBits;
+        return (shift + 1) * sub_buckets + static_cast<int>((v >> shift) - sub_buckets);
+    }
+
+    // the largest value that falls into bucket i
+    static auto highest(int i) -> std::uint64_t
+    {
+        auto g = i / sub_buckets;
+        auto sub = static_cast<std::uint64_t>(i % sub_buckets);
+        if (g == 0)
+            return sub;
+        auto shift = g - 1;
+        return ((sub_buckets + sub + 1) << shift) - 1;
+    }
+
+    void record(std::uint64_t v)
+    {
+        counts[index(v)]++;
+        total++;
+        sum += v;
+        low = std::min(low, v);
+        high = std::max(high, v);
+    }
+
+    void merge(basic_histogram const& other)
+    {
+        for (auto i = 0u; i < counts.size(); i++)
+            counts[i] += other.counts[i];
+        total += other.total;
+        sum += other.sum;
+        low = std::min(low, other.low);
+        high = std::max(high, other.high);
+    }
+
+    void reset()
+    {
+        std::fill(counts.begin(), counts.end(), 0);
+        total = sum = 0;
+        low = std::numeric_limits<std::uint64_t>::max();
+        high = 0;
+    }
+
+    auto count() const { return total; }
+
+    auto min() const { return total ? low : 0; }
+
+    auto max() const { return high; }
+
+    auto mean() const -> double { return total ? static_cast<double>(sum) / total : 0; }
+
+    // the value below which fraction q of the values lie, 0 <= q <= 1
+    auto percentile(double q) const -> std::uint64_t
+    {
+        if (!total)
+            return 0;
+        auto rank = static_cast<std::uint64_t>(q * total);
+        rank = std::clamp<std::uint64_t>(rank, 1, total);
+        std::uint64_t seen = 0;
+        for (auto i = 0u; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= rank)
+                return std::min(highest(i), high);
+        }
+        return high;
+    }
+
+    std::vector<std::uint64_t> counts;
+    std::uint64_t total{0};
+    std::uint64_t sum{0};
+    std::uint64_t low{std::numeric_limits<std::uint64_t>::max()};
+    std::uint64_t high{0};
+};
+
+using histogram = basic_histogram<>;
+
+} // namespace util
@@ -0,0 +1,496 @@
+#pragma once
+#include <string>
+#include <optional>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bucket.hh"
+#include "hash.hh"
+
+namespace util
+{
+
+// the file format of a trie image, one file that is mapped and read in place.
+// a header is followed by the nodes, every one aligned to 8 bytes, and nodes
+// link to each other by refs: the offset of a node in the file with its kind
+// in the lowest 3 bits, 0 for an empty slot. nothing depends on where the
+// file is mapped. children are written before their parents, so the writer
+// never goes back but for the header, and root comes last.
+//
+//   leaf   hash, key, value
+//   bucket hash, count, count keys, count values, the keys sharing a hash
+//   anode  size, size refs, 4 or 16
+//
+// keys and values are copied bytewise, so they have to be trivially
+// copyable, and the file is only read on a machine of the same byte order.
+// an image has to be read with the hash it was written with, only the width
+// of the hash is checked.
+namespace image
+{
+
+inline constexpr char magic[8] = {'t', 'r', 'i', 'e', 'i', 'm', 'g', '\0'};
+inline constexpr std::uint32_t version = 1;
+inline constexpr std::uint32_t byte_order = 0x01020304;
+
+enum kind : std::uint64_t { empty, leaf_kind, bucket_kind, anode_kind };
+
+inline constexpr std::uint64_t kind_mask = 0x7;
+
+struct header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t key_size;
+    std::uint32_t value_size;
+    std::uint32_t hash_size;
+    std::uint32_t reserved;
+    // keys in the image
+    std::uint64_t keys;
+    // the ref of the root anode
+    std::uint64_t root;
+    // the size of the file, anything shorter was cut off
+    std::uint64_t bytes;
+};
+
+inline auto kind_of(std::uint64_t ref) -> kind { return static_cast<kind>(ref & kind_mask); }
+
+inline auto offset_of(std::uint64_t ref) -> std::uint64_t { return ref & ~kind_mask; }
+
+inline auto align(std::uint64_t n, std::uint64_t a) -> std::uint64_t { return (n + a - 1) / a * a; }
+
+template <class Key, class T, class HashType>
+struct layout
+{
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<T>);
+    static_assert(alignof(Key) <= 8 && alignof(T) <= 8 && alignof(HashType) <= 8);
+
+    struct leaf
+    {
+        HashType hash;
+        Key key;
+        T value;
+    };
+
+    struct bucket
+    {
+        HashType hash;
+        std::uint64_t count;
+
+        auto keys() const -> Key const*
+        {
+            return reinterpret_cast<Key const*>(reinterpret_cast<char const*>(this) + sizeof(bucket));
+        }
+
+        auto values() const -> T const*
+        {
+            auto at = align(sizeof(bucket) + count * sizeof(Key), alignof(T));
+            return reinterpret_cast<T const*>(reinterpret_cast<char const*>(this) + at);
+        }
+    };
+
+    struct anode
+    {
+        std::uint64_t size;
+
+        auto slots() const -> std::uint64_t const*
+        {
+            return reinterpret_cast<std::uint64_t const*>(this + 1);
+        }
+    };
+};
+
+// how a writer goes about the file
+struct options
+{
+    // bytes per second the file is written at most, 0 for no limit. the
+    // writer sleeps after a buffer is written as long as it is ahead.
+    double rate{0};
+    // O_DIRECT, buffers go to the disk without the page cache, where the
+    // file system takes it
+    bool direct{false};
+};
+
+// writes an image to a file through a buffer of buffer_size bytes, node by
+// node, children first, see util::image. leaf, bucket and anode return the
+// ref of what they wrote, finish writes the header once root is written.
+// only full buffers are written before finish, so the writes are large and
+// aligned, as O_DIRECT wants them. the room of the header is written as
+// zeros and the header over it at the end. the first error sticks,
+// everything after it is skipped and finish fails, errno tells why.
+template <class Key, class T, class HashType>
+struct writer
+{
+    using layout_type = layout<Key, T, HashType>;
+    using clock_type = std::chrono::steady_clock;
+
+    static constexpr std::size_t buffer_size = 1 << 20;
+    static constexpr std::size_t block_size = 4096;
+
+    explicit writer(std::string const& path, options const& o = {})
+        : rate(o.rate), buffer(static_cast<char*>(std::aligned_alloc(block_size, buffer_size)))
+    {
+        auto flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+        if (o.direct)
+            fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+#endif
+        if (fd < 0)
+            fd = ::open(path.c_str(), flags, 0644);
+        if (fd < 0 || !buffer) {
+            error = fd < 0 ? errno : ENOMEM;
+            return;
+        }
+        std::memset(buffer, 0, sizeof(header));
+        used = sizeof(header);
+        written = sizeof(header);
+        start = clock_type::now();
+    }
+
+    writer(writer const&) = delete;
+    writer& operator=(writer const&) = delete;
+
+    ~writer()
+    {
+        if (fd >= 0)
+            ::close(fd);
+        std::free(buffer);
+    }
+
+    explicit operator bool() const { return !error; }
+
+    auto leaf(HashType hash, Key const& key, T const& value) -> std::uint64_t
+    {
+        typename layout_type::leaf l;
+        std::memset(&l, 0, sizeof(l));
+        l.hash = hash;
+        std::memcpy(&l.key, &key, sizeof(Key));
+        std::memcpy(&l.value, &value, sizeof(T));
+        keys += 1;
+        return append(&l, sizeof(l), leaf_kind);
+    }
+
+    // every bucket of the chain of b
+    auto bucket(HashType hash, util::bucket<Key, T> const& b) -> std::uint64_t
+    {
+        std::uint64_t count = b.count();
+        auto at = begin_node();
+        typename layout_type::bucket h;
+        std::memset(&h, 0, sizeof(h));
+        h.hash = hash;
+        h.count = count;
+        put(&h, sizeof(h));
+        b.for_each([&](Key const& key, T const&) { put(&key, sizeof(Key)); });
+        pad(align(sizeof(h) + count * sizeof(Key), alignof(T)) - sizeof(h) - count * sizeof(Key));
+        b.for_each([&](Key const&, T const& value) { put(&value, sizeof(T)); });
+        keys += count;
+        return at | bucket_kind;
+    }
+
+    auto anode(std::uint64_t const* slots, std::uint64_t size) -> std::uint64_t
+    {
+        auto at = begin_node();
+        put(&size, sizeof(size));
+        put(slots, size * sizeof(std::uint64_t));
+        return at | anode_kind;
+    }
+
+    auto finish(std::uint64_t root) -> bool
+    {
+        if (error)
+            return false;
+#ifdef O_DIRECT
+        // the rest is not a whole block
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_DIRECT);
+#endif
+        flush();
+        if (error)
+            return false;
+        header h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.version = version;
+        h.byte_order = byte_order;
+        h.key_size = sizeof(Key);
+        h.value_size = sizeof(T);
+        h.hash_size = sizeof(HashType);
+        h.keys = keys;
+        h.root = root;
+        h.bytes = written;
+        if (::pwrite(fd, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h)) || ::fsync(fd) != 0)
+            error = errno ? errno : EIO;
+        ::close(fd);
+        fd = -1;
+        return !error;
+    }
+
+    // bytes taken so far, the header included
+    auto bytes() const -> std::uint64_t { return written; }
+
+    // keys taken so far
+    auto count() const -> std::uint64_t { return keys; }
+
+private:
+    auto begin_node() -> std::uint64_t
+    {
+        pad(align(written, 8) - written);
+        return written;
+    }
+
+    auto append(void const* p, std::size_t n, kind k) -> std::uint64_t
+    {
+        auto at = begin_node();
+        put(p, n);
+        return at | k;
+    }
+
+    void pad(std::size_t n)
+    {
+        static constexpr char zeros[8] = {};
+        put(zeros, n);
+    }
+
+    void put(void const* p, std::size_t n)
+    {
+        written += n;
+        if (error)
+            return;
+        auto bytes = static_cast<char const*>(p);
+        while (n) {
+            auto k = std::min(n, buffer_size - used);
+            std::memcpy(buffer + used, bytes, k);
+            used += k;
+            bytes += k;
+            n -= k;
+            if (used == buffer_size)
+                flush();
+        }
+    }
+
+    void flush()
+    {
+        auto p = buffer;
+        auto n = used;
+        while (n && !error) {
+            auto w = ::write(fd, p, n);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0) {
+                error = w < 0 ? errno : EIO;
+                break;
+            }
+            p += w;
+            n -= static_cast<std::size_t>(w);
+        }
+        flushed += used;
+        used = 0;
+        if (rate > 0) {
+            auto due = start + std::chrono::duration_cast<clock_type::duration>(
+                std::chrono::duration<double>(static_cast<double>(flushed) / rate));
+            std::this_thread::sleep_until(due);
+        }
+    }
+
+    int fd{-1};
+    int error{0};
+    double rate;
+    clock_type::time_point start;
+    char* buffer;
+    std::size_t used{0};
+    std::uint64_t flushed{0};
+    std::uint64_t written{0};
+    std::uint64_t keys{0};
+};
+
+} // namespace image
+
+// a trie image mapped read only, see util::image. lookups read the file in
+// place and nothing is built, so opening takes as long as the checks of the
+// header. whatever fails leaves it empty, error says why.
+template <class Key, class T, class Hash = util::hash<Key>>
+struct mapped_trie
+{
+    using key_type    = Key;
+    using value_type  = T;
+    using hash_type   = util::hash_result_t<Hash, Key>;
+    using hasher      = Hash;
+    using layout_type = image::layout<Key, T, hash_type>;
+    using leaf        = typename layout_type::leaf;
+    using bucket      = typename layout_type::bucket;
+    using anode       = typename layout_type::anode;
+
+    explicit mapped_trie(std::string const& path, Hash const& hash_function = Hash{})
+        : hash_function(hash_function)
+    {
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = std::strerror(errno);
+            return;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            error = std::strerror(errno);
+        } else if (static_cast<std::size_t>(st.st_size) < sizeof(image::header)) {
+            error = "not a trie image";
+        } else {
+            size = static_cast<std::size_t>(st.st_size);
+            auto p = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                error = std::strerror(errno);
+                size = 0;
+            } else {
+                base = static_cast<char const*>(p);
+                check();
+            }
+        }
+        ::close(fd);
+        if (!error.empty())
+            unmap();
+    }
+
+    mapped_trie(mapped_trie const&) = delete;
+    mapped_trie& operator=(mapped_trie const&) = delete;
+
+    ~mapped_trie() { unmap(); }
+
+    explicit operator bool() const { return base != nullptr; }
+
+    auto hash(key_type const& key) const -> hash_type
+    {
+        return static_cast<hash_type>(hash_function(key));
+    }
+
+    auto lookup(key_type const& key) const -> std::optional<value_type>
+    {
+        return lookup(key, hash(key));
+    }
+
+    auto lookup(key_type const& key, hash_type hash) const -> std::optional<value_type>
+    {
+        if (!base)
+            return {};
+        auto ref = top().root;
+        for (auto level = 0; ; level += 4) {
+            auto an = node<anode>(ref);
+            ref = an->slots()[(hash >> level) & (an->size - 1)];
+            switch (image::kind_of(ref)) {
+            case image::leaf_kind: {
+                auto l = node<leaf>(ref);
+                if (l->hash == hash && l->key == key)
+                    return l->value;
+                return {};
+            }
+            case image::bucket_kind: {
+                auto b = node<bucket>(ref);
+                if (b->hash != hash)
+                    return {};
+                for (auto i = 0u; i < b->count; i++)
+                    if (b->keys()[i] == key)
+                        return b->values()[i];
+                return {};
+            }
+            case image::anode_kind:
+                break;
+            default:
+                return {};
+            }
+        }
+    }
+
+    // every key of the image once, as fn(key, value), in the order of the
+    // file
+    template <class F>
+    void for_each(F&& fn) const
+    {
+        if (base)
+            for_each(top().root, fn);
+    }
+
+    auto keys() const -> std::uint64_t { return base ? top().keys : 0; }
+
+    auto bytes() const -> std::size_t { return size; }
+
+    // the nodes, for whoever copies the image, see concurrent::trie
+    auto root() const -> std::uint64_t { return top().root; }
+
+    template <class U>
+    auto node(std::uint64_t ref) const -> U const*
+    {
+        return reinterpret_cast<U const*>(base + image::offset_of(ref));
+    }
+
+    std::string error;
+
+private:
+    auto top() const -> image::header const& { return *reinterpret_cast<image::header const*>(base); }
+
+    void check()
+    {
+        auto const& h = top();
+        if (std::memcmp(h.magic, image::magic, sizeof(image::magic)) != 0)
+            error = "not a trie image";
+        else if (h.version != image::version)
+            error = "unknown image version " + std::to_string(h.version);
+        else if (h.byte_order != image::byte_order)
+            error = "image of another byte order";
+        else if (h.key_size != sizeof(Key) || h.value_size != sizeof(T) || h.hash_size != sizeof(hash_type))
+            error = "image of other key, value or hash types";
+        else if (h.bytes != size)
+            error = "image cut off";
+        else if (image::kind_of(h.root) != image::anode_kind
+            || image::offset_of(h.root) + sizeof(anode) > size
+            || node<anode>(h.root)->size != 16)
+            error = "image without a root";
+    }
+
+    template <class F>
+    void for_each(std::uint64_t ref, F& fn) const
+    {
+        auto an = node<anode>(ref);
+        for (auto i = 0u; i < an->size; i++) {
+            auto u = an->slots()[i];
+            switch (image::kind_of(u)) {
+            case image::leaf_kind: {
+                auto l = node<leaf>(u);
+                fn(l->key, l->value);
+                break;
+            }
+            case image::bucket_kind: {
+                auto b = node<bucket>(u);
+                for (auto k = 0u; k < b->count; k++)
+                    fn(b->keys()[k], b->values()[k]);
+                break;
+            }
+            case image::anode_kind:
+                for_each(u, fn);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    void unmap()
+    {
+        if (base)
+            ::munmap(const_cast<char*>(base), size);
+        base = nullptr;
+        size = 0;
+    }
+
+    char const* base{nullptr};
+    std::size_t size{0};
+    hasher hash_function;
+};
+
+} // namespace util
@@ -0,0 +1,26 @@
+#pragma once
+#include <fstream>
+#include <cstddef>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+namespace util
+{
+
+// the resident set of the process in bytes, from /proc/self/statm, or 0 where
+// there is no such file. the difference around building a structure is what
+// it takes, heap overhead and fragmentation included, as long as nothing is
+// freed meanwhile.
+inline auto resident_bytes() -> std::size_t
+{
+#ifdef __linux__
+    std::ifstream statm{"/proc/self/statm"};
+    std::size_t size = 0, resident = 0;
+    if (statm >> size >> resident)
+        return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    return 0;
+}
+
+} // namespace util
@@ -0,0 +1,150 @@
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <array>
+#include <string>
+#include <utility>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+namespace util
+{
+
+// a group of hardware counters of the calling thread, read together around
+// the same regions a timer wraps. events the cpu or the kernel do not offer
+// are left out, without any the group is unavailable and start and stop do
+// nothing, so benchmarks run the same where perf_event_open is not allowed,
+// e.g. in containers or with perf_event_paranoid above 2.
+struct perf_counters
+{
+    enum event { cycles, instructions, branch_misses, l1d_misses, llc_misses, dtlb_misses, events };
+
+    static constexpr char const* names[events] = {
+        "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses", "dTLB-misses"
+    };
+
+    perf_counters()
+    {
+#ifdef __linux__
+        auto cache = [](std::uint64_t id, std::uint64_t op, std::uint64_t result) {
+            return id | (op << 8) | (result << 16);
+        };
+        std::pair<std::uint32_t, std::uint64_t> const config[events] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_L1D,
+                PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_DTLB,
+                PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+        };
+        for (auto e = 0; e < events; e++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = config[e].first;
+            attr.config = config[e].second;
+            attr.disabled = leader == -1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP
+                | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            auto fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fd == -1) {
+                if (leader == -1)
+                    error = errno;
+                continue;
+            }
+            if (leader == -1)
+                leader = fd;
+            fds[e] = fd;
+            slot[e] = opened++;
+        }
+#endif
+    }
+
+    perf_counters(perf_counters const&) = delete;
+    perf_counters& operator=(perf_counters const&) = delete;
+
+    ~perf_counters()
+    {
+#ifdef __linux__
+        for (auto fd : fds)
+            if (fd != -1)
+                close(fd);
+#endif
+    }
+
+    auto available() const { return leader != -1; }
+
+    auto has(event e) const { return fds[e] != -1; }
+
+    void start()
+    {
+#ifdef __linux__
+        if (!available())
+            return;
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    // adds the counts since start, scaled up if the kernel had to multiplex
+    // the group with other users of the counters
+    void stop()
+    {
+#ifdef __linux__
+        if (!available())
+            return;
+        ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        // nr, time enabled, time running, a value per event
+        std::uint64_t buf[3 + events];
+        if (read(leader, buf, sizeof(buf)) < static_cast<ssize_t>(3 * sizeof(std::uint64_t)))
+            return;
+        auto scale = buf[2] ? static_cast<double>(buf[1]) / buf[2] : 0.0;
+        for (auto e = 0; e < events; e++)
+            if (has(static_cast<event>(e)))
+                tot[e] += buf[3 + slot[e]] * scale;
+#endif
+    }
+
+    void reset()
+    {
+        tot.fill(0);
+    }
+
+    auto value(event e) const { return tot[e]; }
+
+    // every counter divided by ops
+    void print(std::ostream& os, double ops) const
+    {
+        if (!available()) {
+            os << "perf counters unavailable: " << std::strerror(error) << "\n";
+            return;
+        }
+        os << "per op:" << std::fixed << std::setprecision(2);
+        for (auto e = 0; e < events; e++)
+            if (has(static_cast<event>(e)))
+                os << " " << names[e] << " " << tot[e] / ops;
+        os << "\n" << std::defaultfloat;
+    }
+
+private:
+    int leader{-1};
+    int error{ENOSYS};
+    int opened{0};
+    std::array<int, events> fds{-1, -1, -1, -1, -1, -1};
+    // position of each event in a group read
+    std::array<int, events> slot{};
+    std::array<double, events> tot{};
+};
+
+} // namespace util
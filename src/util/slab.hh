@@ -0,0 +1,130 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+
+namespace util
+{
+
+// a growable arena of objects of one type, a size class. objects live in
+// chunks that never move, each twice the size of the last up to
+// max_chunk objects, and freed objects go on a free list, threaded through
+// their storage, that make takes from before it touches a chunk. a slab is
+// not shared between threads, those that build apart merge their slabs
+// afterwards instead. the objects left in a slab are not destroyed with it,
+// their owner frees them before it goes.
+template <class T>
+struct slab
+{
+    static constexpr std::size_t min_chunk = 32;
+    static constexpr std::size_t max_chunk = 1 << 16;
+
+    slab() = default;
+
+    // room for at least reserve objects before the first chunk is full
+    explicit slab(std::size_t reserve) { grow(std::max(reserve, min_chunk)); }
+
+    slab(slab&&) = default;
+    slab& operator=(slab&&) = default;
+
+    template <class... Args>
+    auto make(Args&&... args) -> T*
+    {
+        cell* c;
+        if (free_list) {
+            c = free_list;
+            free_list = c->next;
+        } else {
+            if (used == chunk_size())
+                grow(std::min(std::max(2 * chunk_size(), min_chunk), max_chunk));
+            c = &chunks.back().cells[used++];
+        }
+        live += 1;
+        return new (c->storage) T{std::forward<Args>(args)...};
+    }
+
+    void free(T* p)
+    {
+        p->~T();
+        auto c = reinterpret_cast<cell*>(p);
+        c->next = free_list;
+        free_list = c;
+        live -= 1;
+    }
+
+    // takes over the chunks and the free list of other, the rest of its
+    // last chunk goes on the free list
+    void merge(slab&& other)
+    {
+        if (other.chunks.empty())
+            return;
+        auto& last = other.chunks.back();
+        for (auto i = other.used; i < last.size; i++) {
+            last.cells[i].next = other.free_list;
+            other.free_list = &last.cells[i];
+        }
+        while (other.free_list) {
+            auto c = other.free_list;
+            other.free_list = c->next;
+            c->next = free_list;
+            free_list = c;
+        }
+        // this slab keeps filling its own last chunk, if it has one
+        auto empty = chunks.empty();
+        chunks.insert(empty ? chunks.end() : chunks.end() - 1,
+            std::make_move_iterator(other.chunks.begin()),
+            std::make_move_iterator(other.chunks.end()));
+        if (empty)
+            used = chunks.back().size;
+        live += other.live;
+        other.chunks.clear();
+        other.used = 0;
+        other.live = 0;
+    }
+
+    // the objects made and not freed
+    auto size() const -> std::size_t { return live; }
+
+    // the objects there is room for in the chunks
+    auto capacity() const -> std::size_t
+    {
+        std::size_t n = 0;
+        for (auto& c : chunks)
+            n += c.size;
+        return n;
+    }
+
+    auto bytes() const -> std::size_t { return capacity() * sizeof(cell); }
+
+private:
+    union cell
+    {
+        cell* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    struct chunk
+    {
+        std::unique_ptr<cell[]> cells;
+        std::size_t size;
+    };
+
+    auto chunk_size() const -> std::size_t { return chunks.empty() ? 0 : chunks.back().size; }
+
+    void grow(std::size_t n)
+    {
+        chunks.push_back({std::unique_ptr<cell[]>(new cell[n]), n});
+        used = 0;
+    }
+
+    std::vector<chunk> chunks;
+    // the cells taken of the last chunk
+    std::size_t used{0};
+    std::size_t live{0};
+    cell* free_list{nullptr};
+};
+
+} // namespace util
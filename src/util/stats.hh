@@ -0,0 +1,146 @@
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <initializer_list>
+#include <cstddef>
+
+namespace util
+{
+
+// the shape and footprint of a trie, see stats of the tries. nodes are
+// counted by kind, in the order of the names a trie gives, and bytes are
+// what the nodes take and own, sizeof and their heap arrays, before the
+// rounding of the allocator. depths counts the leaves, snodes and lnodes,
+// by the depth of the anode holding them, root at 0. pending is what the
+// trie holds on to without using it, nodes retired and not yet freed or
+// free slots of a pool.
+struct trie_stats
+{
+    struct kind
+    {
+        std::string name;
+        std::size_t count{0};
+        std::size_t bytes{0};
+    };
+
+    trie_stats(std::initializer_list<char const*> names)
+    {
+        for (auto name : names)
+            kinds.push_back({name});
+    }
+
+    void add(int k, std::size_t size)
+    {
+        kinds[k].count += 1;
+        kinds[k].bytes += size;
+        bytes += size;
+    }
+
+    // a leaf of count keys in an anode at depth
+    void leaf(int depth, std::size_t count)
+    {
+        if (depth >= static_cast<int>(depths.size()))
+            depths.resize(depth + 1);
+        depths[depth] += 1;
+        keys += count;
+    }
+
+    // an anode of size slots, used of them not empty
+    void slots(int size, int used)
+    {
+        auto& o = size == 4 ? narrow : wide;
+        o.slots += size;
+        o.used += used;
+    }
+
+    auto bytes_per_key() const -> double
+    {
+        return keys ? static_cast<double>(bytes) / keys : 0;
+    }
+
+    struct occupancy
+    {
+        auto ratio() const -> double { return slots ? static_cast<double>(used) / slots : 0; }
+
+        std::size_t slots{0};
+        std::size_t used{0};
+    };
+
+    void print(std::ostream& os) const
+    {
+        auto flags = os.flags();
+        auto precision = os.precision();
+        os << std::fixed << std::setprecision(2)
+            << "keys " << keys << ", bytes " << bytes << ", " << bytes_per_key() << " bytes/key\n";
+        for (auto& k : kinds)
+            if (k.count)
+                os << "    " << k.name << ": " << k.count << ", " << k.bytes << " bytes\n";
+        os << "    occupancy: narrow " << narrow.ratio() << ", wide " << wide.ratio() << "\n";
+        os << "    depths:";
+        for (auto d : depths)
+            os << " " << d;
+        os << "\n    pending: " << pending << "\n";
+        os.flags(flags);
+        os.precision(precision);
+    }
+
+    void write_json(std::ostream& os) const
+    {
+        auto flags = os.flags();
+        auto precision = os.precision();
+        os << std::fixed << std::setprecision(4) << "{\"keys\": " << keys << ", \"bytes\": " << bytes
+            << ", \"bytes_per_key\": " << bytes_per_key() << ", \"nodes\": {";
+        auto first = true;
+        for (auto& k : kinds) {
+            os << (first ? "" : ", ") << "\"" << k.name << "\": {\"count\": "
+                << k.count << ", \"bytes\": " << k.bytes << "}";
+            first = false;
+        }
+        os << "}, \"occupancy\": {\"narrow\": " << narrow.ratio()
+            << ", \"wide\": " << wide.ratio() << "}, \"depths\": [";
+        for (auto d = 0u; d < depths.size(); d++)
+            os << (d ? ", " : "") << depths[d];
+        os << "], \"pending\": " << pending << "}\n";
+        os.flags(flags);
+        os.precision(precision);
+    }
+
+    std::vector<kind> kinds;
+    std::size_t keys{0};
+    std::size_t bytes{0};
+    std::vector<std::size_t> depths;
+    occupancy narrow;
+    occupancy wide;
+    std::size_t pending{0};
+};
+
+// a graph in the dot language, written as a trie walks its nodes, so that
+// nothing but the stream grows with the trie. nodes are named by address.
+struct dot_writer
+{
+    explicit dot_writer(std::ostream& os) : os(os) { os << "digraph trie {\n    node [shape=box];\n"; }
+
+    ~dot_writer() { os << "}\n"; }
+
+    dot_writer(dot_writer const&) = delete;
+    dot_writer& operator=(dot_writer const&) = delete;
+
+    template <class... Label>
+    void node(void const* id, Label const&... label)
+    {
+        os << "    \"" << id << "\" [label=\"";
+        (os << ... << label);
+        os << "\"];\n";
+    }
+
+    void edge(void const* from, void const* to, int pos)
+    {
+        os << "    \"" << from << "\" -> \"" << to << "\" [label=" << pos << "];\n";
+    }
+
+    std::ostream& os;
+};
+
+} // namespace util
@@ -0,0 +1,223 @@
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <array>
+#include <type_traits>
+#include <cstdint>
+#include <pthread.h>
+#include <sched.h>
+#include "timer.hh"
+#include "histogram.hh"
+
+namespace util
+{
+
+// a mixed workload for maps with lookup(key), insert(key, value) and
+// remove(key). the map is prefilled with about prefill of key_range, equal
+// shares of inserts and removes keep it at that size. one operation in
+// every latency is timed into a histogram of its type, 0 times none.
+struct workload
+{
+    int lookup{80};
+    int insert{10};
+    int remove{10};
+    int key_range{1 << 20};
+    double prefill{0.5};
+    std::chrono::milliseconds duration{1000};
+    int latency{0};
+};
+
+enum op_type { lookup_op, insert_op, remove_op };
+
+struct throughput_result
+{
+    int threads;
+    // operations per second of every thread
+    std::vector<double> per_thread;
+    double total;
+    // in cycle_clock ticks, merged over the threads, empty without latency
+    std::array<histogram, 3> latency;
+};
+
+// xorshift64*, a random generator cheap enough not to show up in the
+// throughput of the map.
+struct fast_random
+{
+    explicit fast_random(std::uint64_t seed) : state(seed * 0x9e3779b97f4a7c15ull | 1) {}
+
+    auto operator()() -> std::uint64_t
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545f4914f6cdd1dull;
+    }
+
+    std::uint64_t state;
+};
+
+// pins the calling thread to cpu modulo the cpus there are, threads beyond
+// that share cpus. a failure only costs stability of the numbers.
+inline void pin_thread(int cpu)
+{
+    auto n = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % n, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+template <class Map>
+void prefill(Map& m, workload const& w)
+{
+    fast_random gen{0};
+    auto threshold = static_cast<std::uint64_t>(w.prefill * 1000);
+    for (auto k = 0; k < w.key_range; k++)
+        if (gen() % 1000 < threshold)
+            m.insert(k, k);
+}
+
+// runs threads pinned threads over w on m. every thread counts its own
+// operations and time, they start together and stop at the same flag.
+//
+// latencies are sampled. a tick read on both sides of every operation keeps
+// the core from overlapping the cache misses of consecutive operations and
+// costs the trie more than half its throughput, timing one in 64 is within
+// the noise. the loop is compiled twice so runs without latency do not pay
+// even for the countdown.
+template <class Map>
+auto bench_throughput(Map& m, int threads, workload const& w) -> throughput_result
+{
+    std::atomic<int> ready{0};
+    std::atomic<bool> start{false};
+    std::atomic<bool> stop{false};
+    std::vector<double> per_thread(threads);
+    std::vector<std::array<histogram, 3>> latency(w.latency > 0 ? threads : 0);
+    std::vector<std::thread> workers;
+    for (auto id = 0; id < threads; id++)
+        workers.emplace_back([&, id] {
+            pin_thread(id);
+            fast_random gen{static_cast<std::uint64_t>(id) + 1};
+            ready++;
+            while (!start.load())
+                std::this_thread::yield();
+            long long ops = 0;
+            timer t;
+            auto run = [&](auto sampled) {
+                [[maybe_unused]] auto left = w.latency;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    auto r = gen();
+                    auto op = static_cast<int>(r % 100);
+                    auto key = static_cast<int>((r >> 32) % w.key_range);
+                    auto type = lookup_op;
+                    [[maybe_unused]] auto timed = false;
+                    [[maybe_unused]] std::uint64_t begin = 0;
+                    if constexpr (decltype(sampled)::value) {
+                        if ((timed = --left == 0)) {
+                            left = w.latency;
+                            begin = cycle_clock::now();
+                        }
+                    }
+                    if (op < w.lookup) {
+                        m.lookup(key);
+                    } else if (op < w.lookup + w.insert) {
+                        m.insert(key, key);
+                        type = insert_op;
+                    } else {
+                        m.remove(key);
+                        type = remove_op;
+                    }
+                    if constexpr (decltype(sampled)::value) {
+                        if (timed)
+                            latency[id][type].record(cycle_clock::now() - begin);
+                    }
+                    ops++;
+                }
+            };
+            t.start();
+            if (w.latency > 0)
+                run(std::true_type{});
+            else
+                run(std::false_type{});
+            t.stop();
+            per_thread[id] = ops / t.elapsed_seconds();
+        });
+
+    while (ready.load() != threads)
+        std::this_thread::yield();
+    start = true;
+    std::this_thread::sleep_for(w.duration);
+    stop = true;
+    for (auto& t : workers)
+        t.join();
+
+    auto total = std::accumulate(per_thread.begin(), per_thread.end(), 0.0);
+    throughput_result res{threads, per_thread, total, {}};
+    for (auto const& l : latency)
+        for (auto type = 0; type < 3; type++)
+            res.latency[type].merge(l[type]);
+    return res;
+}
+
+// 1, 2, 4, ... up to max, and max itself
+inline auto thread_counts(int max) -> std::vector<int>
+{
+    std::vector<int> counts;
+    for (auto n = 1; n < max; n *= 2)
+        counts.push_back(n);
+    counts.push_back(max);
+    return counts;
+}
+
+inline void print(throughput_result const& r)
+{
+    std::cout << std::setw(4) << r.threads << " threads: "
+        << std::fixed << std::setprecision(3) << r.total / 1e6 << " Mops/s, per thread [";
+    for (auto i = 0u; i < r.per_thread.size(); i++)
+        std::cout << (i ? " " : "") << r.per_thread[i] / 1e6;
+    std::cout << "]\n" << std::defaultfloat;
+
+    auto scale = cycle_clock::nanoseconds_per_tick();
+    char const* names[] = {"lookup", "insert", "remove"};
+    for (auto type = 0; type < 3; type++) {
+        auto const& h = r.latency[type];
+        if (!h.count())
+            continue;
+        std::cout << "    " << names[type] << " ns:";
+        for (auto [name, q] : {std::pair{"p50", 0.5}, std::pair{"p99", 0.99}, std::pair{"p999", 0.999}})
+            std::cout << " " << name << " " << static_cast<long long>(h.percentile(q) * scale);
+        std::cout << " max " << static_cast<long long>(h.max() * scale)
+            << " mean " << static_cast<long long>(h.mean() * scale) << "\n";
+    }
+}
+
+// the scaling curve of Map, a fresh prefilled map for every thread count
+template <class Map>
+auto bench_scaling(
+    std::string const& name,
+    workload const& w,
+    std::vector<int> const& counts
+) -> std::vector<throughput_result>
+{
+    std::cout << "testing [" << name << ", " << w.lookup << "% lookup "
+        << w.insert << "% insert " << w.remove << "% remove, "
+        << w.key_range << " keys]\n";
+    std::vector<throughput_result> res;
+    for (auto threads : counts) {
+        Map m;
+        prefill(m, w);
+        res.push_back(bench_throughput(m, threads, w));
+        print(res.back());
+    }
+    std::cout << std::string(80, '=') << "\n";
+    return res;
+}
+
+} // namespace util
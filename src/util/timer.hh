@@ -1,5 +1,10 @@
 #pragma once
 #include <chrono>
+#include <thread>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 namespace util
 {
@@ -43,5 +48,36 @@ private:
     elapsed_type tot{0};
 };
 
+// raw ticks for timing single operations, the time stamp counter where there
+// is one, which costs a fraction of a clock_type::now(). ticks are only
+// meaningful as differences, nanoseconds_per_tick converts them.
+struct cycle_clock
+{
+    static auto now() -> std::uint64_t
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    // measured once against steady_clock
+    static auto nanoseconds_per_tick() -> double
+    {
+        static double const value = [] {
+            using clock = std::chrono::steady_clock;
+            auto s = clock::now();
+            auto t0 = now();
+            std::this_thread::sleep_for(std::chrono::milliseconds{20});
+            auto e = clock::now();
+            auto t1 = now();
+            std::chrono::duration<double, std::nano> elapsed = e - s;
+            return t1 == t0 ? 1.0 : elapsed.count() / (t1 - t0);
+        }();
+        return value;
+    }
+};
+
 } // namespace util
 
@@ -0,0 +1,535 @@
+// ml:ccf += -pthread
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+#include <filesystem>
+#include "../src/util/progress-display.hh"
+#include "../src/concurrent/trie.hh"
+#include "../src/concurrent/checkpoint.hh"
+
+// every thread works on its own keys, so that the trie can be checked
+// against a per-thread map while all threads share the nodes above them.
+// Collisions consecutive keys share a hash, so that threads share lnodes too,
+// and hashes are shifted left by Shift, so that the trie branches only at
+// deep levels.
+// 0: lookup, 1: insert, 2: remove
+
+template <int Collisions, int Shift, class Trie>
+auto thread_ops(Trie& t, int id, int threads, int ops, int max) -> bool
+{
+    auto hash = [](int key) { return std::uint64_t(key / Collisions) << Shift; };
+    std::unordered_map<int, int> um;
+    std::mt19937 gen{static_cast<unsigned>(id) * 7919u + 1};
+    std::uniform_int_distribution<> dis_op(0, 2);
+    std::uniform_int_distribution<> dis_key(0, max / threads);
+    for (auto i = 0; i < ops; i++) {
+        auto op = dis_op(gen);
+        auto key = dis_key(gen) * threads + id;
+        std::optional<int> gt;
+        if (um.count(key))
+            gt = um.at(key);
+        if (op == 0) {
+            if (t.lookup(key, hash(key)) != gt)
+                return false;
+        } else if (op == 1) {
+            t.insert(key, key, hash(key));
+            um[key] = key;
+        } else {
+            if (t.remove(key, hash(key)) != gt)
+                return false;
+            um.erase(key);
+        }
+    }
+    for (auto [key, value] : um)
+        if (t.lookup(key, hash(key)) != value)
+            return false;
+    // and all of them removed, while the others compress the anodes above
+    for (auto [key, value] : um)
+        if (t.remove(key, hash(key)) != value)
+            return false;
+    return true;
+}
+
+template <class Reclaimer, int Threads = 8, int Ops = 100'000, int Repeat = 100,
+    int Collisions = 1, int Shift = 0, class Allocator = concurrent::heap_allocator>
+void multi_thread_test(std::string const& name, int max = 100)
+{
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: multi_thread_test [" << name << "]\n";
+
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        concurrent::trie<int, int, util::hash<int>, Reclaimer, concurrent::no_backoff, Allocator> t;
+        std::atomic<bool> ok{true};
+        std::vector<std::thread> threads;
+        for (auto id = 0; id < Threads; id++)
+            threads.emplace_back([&, id] {
+                if (!thread_ops<Collisions, Shift>(t, id, Threads, Ops, max))
+                    ok = false;
+            });
+        for (auto& th : threads)
+            th.join();
+        if (!ok || t.stats().keys != 0) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+// every thread updates Keys keys of its own in rounds, inserting them with
+// the number of the op as value in even rounds and removing them in odd
+// ones, so the state of its keys after any n ops is known. a snapshot must
+// hold the keys of every thread after some n between the ops the thread had
+// finished before the snapshot was asked for and the one it was running when
+// the snapshot returned, and hold the same once all threads are done.
+template <int Keys>
+auto after_ops(long n, int j) -> std::optional<int>
+{
+    if (n <= j)
+        return {};
+    auto last = j + Keys * ((n - 1 - j) / Keys);
+    if (last / Keys % 2)
+        return {};
+    return static_cast<int>(last);
+}
+
+template <int Threads, int Keys, int Shift, class View>
+auto snapshot_ops(View const& v, int id, long from, long to) -> long
+{
+    auto hash = [](int key) { return std::uint64_t(key) << Shift; };
+    for (auto n = from; n <= to; n++) {
+        auto j = 0;
+        for (; j < Keys; j++) {
+            auto key = j * Threads + id;
+            if (v.lookup(key, hash(key)) != after_ops<Keys>(n, j))
+                break;
+        }
+        if (j == Keys)
+            return n;
+    }
+    return -1;
+}
+
+template <class Reclaimer, int Threads = 4, int Keys = 64, int Ops = 100'000, int Repeat = 10,
+    int Shift = 0>
+void snapshot_thread_test(std::string const& name)
+{
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: snapshot_thread_test [" << name << "]\n";
+
+    using trie_type = concurrent::trie<int, int, util::hash<int>, Reclaimer>;
+    auto hash = [](int key) { return std::uint64_t(key) << Shift; };
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        trie_type t;
+        std::vector<std::atomic<long>> done(Threads);
+        std::vector<std::thread> threads;
+        for (auto id = 0; id < Threads; id++)
+            threads.emplace_back([&, id] {
+                for (auto n = 0; n < Ops; n++) {
+                    auto key = n % Keys * Threads + id;
+                    if (n / Keys % 2)
+                        t.remove(key, hash(key));
+                    else
+                        t.insert(key, n, hash(key));
+                    done[id].store(n + 1);
+                }
+            });
+        auto ok = true;
+        std::vector<std::pair<typename trie_type::view, std::vector<long>>> snapshots;
+        for (auto finished = false; !finished && ok; ) {
+            std::vector<long> from(Threads), ns(Threads);
+            finished = true;
+            for (auto id = 0; id < Threads; id++) {
+                from[id] = done[id].load();
+                finished = finished && from[id] == Ops;
+            }
+            auto v = t.snapshot();
+            for (auto id = 0; id < Threads; id++) {
+                auto to = std::min<long>(done[id].load() + 1, Ops);
+                ns[id] = snapshot_ops<Threads, Keys, Shift>(v, id, from[id], to);
+                ok = ok && ns[id] >= 0;
+            }
+            if (snapshots.size() < 64)
+                snapshots.emplace_back(std::move(v), ns);
+        }
+        for (auto& th : threads)
+            th.join();
+        for (auto& [v, ns] : snapshots)
+            for (auto id = 0; id < Threads; id++)
+                ok = ok && snapshot_ops<Threads, Keys, Shift>(v, id, ns[id], ns[id]) == ns[id];
+        if (!ok) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+// Keys keys that never change are looked up by every thread, along with
+// as many that are not there, while one thread takes snapshots and drops
+// them right away. every snapshot swaps root and the view retires the old
+// one, so a lookup that walks down from root has to hold it.
+template <class Reclaimer, int Threads = 4, int Keys = 4096, int Ops = 200'000, int Repeat = 10>
+void snapshot_lookup_thread_test(std::string const& name)
+{
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: snapshot_lookup_thread_test [" << name << "]\n";
+
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        concurrent::trie<int, int, util::hash<int>, Reclaimer> t;
+        for (auto key = 0; key < Keys; key++)
+            t.insert(key, key);
+        std::atomic<bool> ok{true};
+        std::atomic<int> running{Threads};
+        std::vector<std::thread> threads;
+        for (auto id = 0; id < Threads; id++)
+            threads.emplace_back([&, id] {
+                std::mt19937 gen{static_cast<unsigned>(id) * 7919u + 1};
+                std::uniform_int_distribution<> dis_key(0, 2 * Keys - 1);
+                for (auto n = 0; n < Ops; n++) {
+                    auto key = dis_key(gen);
+                    std::optional<int> gt;
+                    if (key < Keys)
+                        gt = key;
+                    if (t.lookup(key) != gt)
+                        ok = false;
+                }
+                running.fetch_sub(1);
+            });
+        while (running.load())
+            t.snapshot();
+        for (auto& th : threads)
+            th.join();
+        if (!ok) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+// thread id owns the keys j * Threads + id, it inserts and removes those of
+// odd j while a traversal runs over and over, and one thread takes snapshots.
+// the keys of even j are there all along, the traversal has to visit each of
+// them once, and every other key at most once.
+template <class Reclaimer, int Threads = 4, int Keys = 256, int Ops = 100'000, int Repeat = 10,
+    int Shift = 0>
+void iterate_thread_test(std::string const& name)
+{
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: iterate_thread_test [" << name << "]\n";
+
+    auto hash = [](int key) { return std::uint64_t(key) << Shift; };
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        concurrent::trie<int, int, util::hash<int>, Reclaimer> t;
+        for (auto key = 0; key < Keys * Threads; key++)
+            if (key / Threads % 2 == 0)
+                t.insert(key, key, hash(key));
+        std::atomic<int> running{Threads};
+        std::vector<std::thread> threads;
+        for (auto id = 0; id < Threads; id++)
+            threads.emplace_back([&, id] {
+                std::mt19937 gen{static_cast<unsigned>(id) + 1};
+                std::uniform_int_distribution<> dis_key(0, Keys / 2 - 1);
+                for (auto n = 0; n < Ops; n++) {
+                    auto key = (dis_key(gen) * 2 + 1) * Threads + id;
+                    if (n % 2)
+                        t.remove(key, hash(key));
+                    else
+                        t.insert(key, key, hash(key));
+                    if (id == 0 && n % 1'000 == 0)
+                        t.snapshot();
+                }
+                running--;
+            });
+        auto ok = true;
+        std::vector<int> seen(Keys * Threads);
+        do {
+            std::fill(seen.begin(), seen.end(), 0);
+            for (auto [key, value] : t) {
+                ok = ok && key == value && key >= 0 && key < Keys * Threads;
+                if (ok)
+                    seen[key] += 1;
+            }
+            for (auto key = 0; key < Keys * Threads; key++)
+                ok = ok && seen[key] <= 1 && (key / Threads % 2 || seen[key] == 1);
+            // stats walk the trie the same way
+            auto s = t.stats();
+            ok = ok && s.keys >= Keys * Threads / 2 && s.keys <= Keys * Threads;
+        } while (running.load() && ok);
+        for (auto& th : threads)
+            th.join();
+        if (!ok) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+// a counter of 16 bytes, too wide to be updated in place, so that fetch_add
+// swaps in a new snode every time. check follows n, a torn update breaks it.
+struct tally
+{
+    long n{0};
+    long check{0};
+
+    friend auto operator+(tally a, tally b) { return tally{a.n + b.n, a.check + b.check}; }
+};
+
+static_assert(!concurrent::trie<int, tally>::in_place);
+
+auto count(long v) -> long { return v; }
+auto count(tally v) -> long { return v.n == v.check ? v.n : -1; }
+
+// every thread adds one to each of Keys shared keys in turn by fetch_add,
+// and inserts and removes keys of its own, so that the anodes above the
+// shared keys expand and compress under the adds, while snapshots freeze
+// them. no add may be lost or counted twice: every one of them sees an old
+// value of its own, the snapshots see the counts grow, and they add up.
+template <class Reclaimer, class Value, int Threads = 4, int Keys = 16, int Ops = 100'000,
+    int Repeat = 10>
+void fetch_add_thread_test(std::string const& name, Value one)
+{
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: fetch_add_thread_test [" << name << "]\n";
+
+    constexpr auto adds = Threads * (Ops / Keys);
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        concurrent::trie<int, Value, util::hash<int>, Reclaimer> t;
+        std::vector<std::atomic<bool>> seen(Keys * adds);
+        std::atomic<bool> ok{true};
+        std::atomic<int> running{Threads};
+        std::vector<std::thread> threads;
+        for (auto id = 0; id < Threads; id++)
+            threads.emplace_back([&, id] {
+                for (auto n = 0; n < Ops; n++) {
+                    auto key = n % Keys;
+                    auto old = t.fetch_add(key, one);
+                    auto c = old ? count(*old) : 0;
+                    if (c < 0 || c >= adds || seen[key * adds + c].exchange(true))
+                        ok = false;
+                    auto own = Keys + n % 256 * Threads + id;
+                    if (n / 256 % 2)
+                        t.remove(own);
+                    else
+                        t.insert(own, one);
+                }
+                running--;
+            });
+        std::vector<long> last(Keys);
+        do {
+            auto v = t.snapshot();
+            for (auto key = 0; key < Keys; key++) {
+                auto c = v.lookup(key) ? count(*v.lookup(key)) : 0;
+                if (c < last[key] || c > adds)
+                    ok = false;
+                last[key] = c;
+            }
+        } while (running.load() && ok);
+        for (auto& th : threads)
+            th.join();
+        for (auto key = 0; key < Keys; key++)
+            if (!t.lookup(key) || count(*t.lookup(key)) != adds)
+                ok = false;
+        if (!ok) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+// the threads of iterate_thread_test run while checkpoints are written, one
+// after the other. every image has to hold each key of even j once, every
+// other key at most once, and thaw into a trie with the same keys.
+template <class Reclaimer, int Threads = 4, int Keys = 256, int Ops = 100'000, int Repeat = 10,
+    int Shift = 0>
+void checkpoint_thread_test(std::string const& name)
+{
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: checkpoint_thread_test [" << name << "]\n";
+
+    using trie_type = concurrent::trie<int, int, util::hash<int>, Reclaimer>;
+    auto path = (std::filesystem::temp_directory_path() / "multi_thread_test.img").string();
+    auto hash = [](int key) { return std::uint64_t(key) << Shift; };
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        trie_type t;
+        for (auto key = 0; key < Keys * Threads; key++)
+            if (key / Threads % 2 == 0)
+                t.insert(key, key, hash(key));
+        std::atomic<int> running{Threads};
+        std::vector<std::thread> threads;
+        for (auto id = 0; id < Threads; id++)
+            threads.emplace_back([&, id] {
+                std::mt19937 gen{static_cast<unsigned>(id) + 1};
+                std::uniform_int_distribution<> dis_key(0, Keys / 2 - 1);
+                for (auto n = 0; n < Ops; n++) {
+                    auto key = (dis_key(gen) * 2 + 1) * Threads + id;
+                    if (n % 2)
+                        t.remove(key, hash(key));
+                    else
+                        t.insert(key, key, hash(key));
+                    if (id == 0 && n % 1'000 == 0)
+                        t.snapshot();
+                }
+                running--;
+            });
+        auto ok = true;
+        std::vector<int> seen(Keys * Threads);
+        do {
+            ok = concurrent::checkpoint<trie_type>{t, path}.wait();
+            util::mapped_trie<int, int> m{path};
+            ok = ok && m;
+            std::fill(seen.begin(), seen.end(), 0);
+            std::uint64_t keys = 0;
+            m.for_each([&](int key, int value) {
+                ok = ok && key == value && key >= 0 && key < Keys * Threads;
+                if (ok)
+                    seen[key] += 1;
+                keys += 1;
+            });
+            for (auto key = 0; key < Keys * Threads; key++)
+                ok = ok && seen[key] <= 1 && (key / Threads % 2 || seen[key] == 1);
+            ok = ok && m.keys() == keys;
+            if (ok) {
+                trie_type thawed{m, 2};
+                for (auto key = 0; key < Keys * Threads; key++)
+                    ok = ok && thawed.lookup(key, hash(key)) == (seen[key] ? std::optional{key} : std::nullopt);
+            }
+        } while (running.load() && ok);
+        for (auto& th : threads)
+            th.join();
+        std::filesystem::remove(path);
+        if (!ok) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+// a batch of the negative keys is loaded while threads run thread_ops on
+// the others, so that the slots of root the load builds may be taken by the
+// time it publishes them. lookup_many reads the batch back while the
+// threads still run.
+template <class Reclaimer, int Threads = 8, int Ops = 100'000, int Repeat = 10>
+void bulk_load_thread_test(std::string const& name, int keys = 100'000)
+{
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: bulk_load_thread_test [" << name << "]\n";
+
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        concurrent::trie<int, int, util::hash<int>, Reclaimer> t;
+        std::vector<std::pair<int, int>> batch;
+        for (auto key = 1; key <= keys; key++)
+            batch.emplace_back(-key, key);
+        std::atomic<bool> ok{true};
+        std::vector<std::thread> threads;
+        for (auto id = 0; id < Threads; id++)
+            threads.emplace_back([&, id] {
+                if (!thread_ops<1, 0>(t, id, Threads, Ops, 1'000))
+                    ok = false;
+            });
+        t.bulk_load(batch, 4);
+        std::vector<int> keys;
+        for (auto [key, value] : batch)
+            keys.push_back(key);
+        std::vector<std::optional<int>> out(keys.size());
+        t.lookup_many(keys, out);
+        for (auto j = 0u; j < keys.size(); j++)
+            if (out[j] != batch[j].second)
+                ok = false;
+        for (auto& th : threads)
+            th.join();
+        for (auto [key, value] : batch)
+            if (t.lookup(key) != value)
+                ok = false;
+        if (!ok) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+int main()
+{
+    multi_thread_test<concurrent::epoch, 8, 100'000, 20>("epoch", 1'000);
+    multi_thread_test<concurrent::epoch, 8, 200'000, 10>("epoch", 1<<30);
+    multi_thread_test<concurrent::hazard, 8, 100'000, 20>("hazard", 1'000);
+    multi_thread_test<concurrent::hazard, 8, 200'000, 10>("hazard", 1<<30);
+    multi_thread_test<concurrent::epoch, 8, 100'000, 10, 12>("epoch, collisions", 10'000);
+    multi_thread_test<concurrent::hazard, 8, 100'000, 10, 12>("hazard, collisions", 10'000);
+    multi_thread_test<concurrent::epoch, 8, 100'000, 10, 1, 44>("epoch, deep", 1<<20);
+    multi_thread_test<concurrent::hazard, 8, 100'000, 10, 1, 44>("hazard, deep", 1<<20);
+    multi_thread_test<concurrent::epoch, 8, 200'000, 10, 1, 0, concurrent::node_pool>(
+        "epoch, node pool", 1<<30);
+    multi_thread_test<concurrent::hazard, 8, 200'000, 10, 1, 0, concurrent::node_pool>(
+        "hazard, node pool", 1<<30);
+    multi_thread_test<concurrent::epoch, 8, 100'000, 10, 12, 0, concurrent::node_pool>(
+        "epoch, collisions, node pool", 10'000);
+    snapshot_thread_test<concurrent::epoch>("epoch");
+    snapshot_thread_test<concurrent::hazard>("hazard");
+    snapshot_thread_test<concurrent::epoch, 4, 16, 100'000, 10, 44>("epoch, deep");
+    snapshot_thread_test<concurrent::hazard, 4, 16, 100'000, 10, 44>("hazard, deep");
+    snapshot_lookup_thread_test<concurrent::epoch>("epoch");
+    snapshot_lookup_thread_test<concurrent::hazard>("hazard");
+    iterate_thread_test<concurrent::epoch>("epoch");
+    iterate_thread_test<concurrent::hazard>("hazard");
+    iterate_thread_test<concurrent::epoch, 4, 256, 100'000, 10, 44>("epoch, deep");
+    iterate_thread_test<concurrent::hazard, 4, 256, 100'000, 10, 44>("hazard, deep");
+    fetch_add_thread_test<concurrent::epoch, long>("epoch, in place", 1);
+    fetch_add_thread_test<concurrent::hazard, long>("hazard, in place", 1);
+    fetch_add_thread_test<concurrent::epoch, tally>("epoch, replaced", {1, 1});
+    fetch_add_thread_test<concurrent::hazard, tally>("hazard, replaced", {1, 1});
+    checkpoint_thread_test<concurrent::epoch>("epoch");
+    checkpoint_thread_test<concurrent::hazard>("hazard");
+    checkpoint_thread_test<concurrent::epoch, 4, 256, 100'000, 10, 44>("epoch, deep");
+    checkpoint_thread_test<concurrent::hazard, 4, 256, 100'000, 10, 44>("hazard, deep");
+    bulk_load_thread_test<concurrent::epoch>("epoch");
+    bulk_load_thread_test<concurrent::hazard>("hazard");
+}
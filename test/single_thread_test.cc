@@ -4,10 +4,20 @@
 #include <algorithm>
 #include <stdexcept>
 #include <random>
+#include <unordered_map>
+#include <memory>
+#include <tuple>
+#include <cstdint>
+#include <filesystem>
 #include "../src/util/progress-display.hh"
+#include "../src/util/slab.hh"
 #include "../src/concurrent/trie.hh"
+#include "../src/sequential/trie.hh"
+#include "../src/sequential/raw-pointer-trie.hh"
 
 // 0: lookup, 1: insert, 2: remove
+// Collisions keys share every hash, so that they end up in lnodes, and hashes
+// are shifted left by Shift, so that the trie branches only at deep levels.
 
 template <int Ops>
 auto generate_ops(int max = 100)
@@ -23,23 +33,73 @@ auto generate_ops(int max = 100)
     return ops;
 }
 
-template <class Array>
+// a traversal of t, or of a view of it, has to visit every key of m once
+template <class Trie>
+auto same_keys(Trie const& t, std::unordered_map<int, int> const& m) -> bool
+{
+    std::unordered_map<int, int> seen;
+    auto once = true;
+    t.for_each([&](int key, int value) {
+        once = once && seen.emplace(key, value).second;
+    });
+    return once && seen == m;
+}
+
+// the stats of t, or of a view of it, count the keys of m, every leaf at
+// one depth, and the bytes of every node
+template <class Trie>
+auto same_stats(Trie const& t, std::unordered_map<int, int> const& m) -> bool
+{
+    auto s = t.stats();
+    std::size_t leaves = 0, bytes = 0;
+    for (auto d : s.depths)
+        leaves += d;
+    for (auto const& k : s.kinds) {
+        bytes += k.bytes;
+        if (k.name == "snode" || k.name == "lnode" || k.name == "flnode")
+            leaves -= k.count;
+    }
+    return s.keys == m.size() && leaves == 0 && bytes == s.bytes;
+}
+
+// removing the keys of m from t leaves nothing but root, every anode below
+// is compressed away on the way
+template <class Trie, class Hash>
+auto purged(Trie& t, std::unordered_map<int, int> const& m, Hash hash) -> bool
+{
+    for (auto [key, value] : m)
+        if (t.remove(key, hash(key)) != value)
+            return false;
+    auto s = t.stats();
+    std::size_t nodes = 0;
+    for (auto const& k : s.kinds)
+        if (k.name != "cache")
+            nodes += k.count;
+    return s.keys == 0 && nodes == 1;
+}
+
+template <int Collisions, int Shift, class Array>
 auto single_thread_once_test(Array const& ops) -> bool
 {
+    auto hash = [](int key) { return std::uint64_t(key / Collisions) << Shift; };
     concurrent::trie<int, int> t;
     std::unordered_map<int, int> um;
     for (auto [i, key] : ops) {
         if (i == 0) {
-            auto res = t.debug_lookup(key);
+            auto res = t.lookup(key, hash(key));
             std::optional<int> gt;
             if (um.count(key))
                 gt = um.at(key);
             if (res != gt) return false;
         } else if (i == 1) {
-            t.debug_insert(key);
+            std::optional<int> gt;
+            if (um.count(key))
+                gt = um.at(key);
+            if (t.exchange(key, key, hash(key)) != gt)
+                return false;
             um[key] = key;
         } else {
-            auto res = t.debug_remove(key);
+            auto res = t.remove(key, hash(key));
             std::optional<int> gt;
             if (um.count(key))
                 gt = um.at(key);
@@ -48,10 +108,325 @@ auto single_thread_once_test(Array const& ops) -> bool
             um.erase(key);
         }
     }
+    return same_keys(t, um) && same_stats(t, um) && purged(t, um, hash);
+}
+
+// a snapshot every Every ops, all of them checked at the end against the map
+// as it was, once the trie has moved on and been destroyed. the first one
+// also starts a second trie, which gets the same ops with negated values.
+template <int Collisions, int Shift, int Every, class Array>
+auto snapshot_once_test(Array const& ops) -> bool
+{
+    using trie_type = concurrent::trie<int, int>;
+    auto hash = [](int key) { return std::uint64_t(key / Collisions) << Shift; };
+    auto t = std::make_unique<trie_type>();
+    std::unique_ptr<trie_type> copy;
+    std::unordered_map<int, int> um, copy_um;
+    std::vector<std::pair<trie_type::view, std::unordered_map<int, int>>> snapshots;
+    auto step = 0;
+    for (auto [i, key] : ops) {
+        if (step++ % Every == 0) {
+            snapshots.emplace_back(t->snapshot(), um);
+            if (!copy) {
+                copy = std::make_unique<trie_type>(snapshots.back().first);
+                copy_um = um;
+            }
+        }
+        for (auto [tr, m, value] : {std::tuple{t.get(), &um, key}, std::tuple{copy.get(), &copy_um, -key}}) {
+            std::optional<int> gt;
+            if (m->count(key))
+                gt = m->at(key);
+            if (i == 0) {
+                if (tr->lookup(key, hash(key)) != gt)
+                    return false;
+            } else if (i == 1) {
+                tr->insert(key, value, hash(key));
+                (*m)[key] = value;
+            } else {
+                if (tr->remove(key, hash(key)) != gt)
+                    return false;
+                m->erase(key);
+            }
+        }
+    }
+    t.reset();
+    for (auto& [v, m] : snapshots) {
+        if (!same_keys(v, m) || !same_stats(v, m))
+            return false;
+        for (auto [i, key] : ops) {
+            std::optional<int> gt;
+            if (m.count(key))
+                gt = m.at(key);
+            if (v.lookup(key, hash(key)) != gt)
+                return false;
+        }
+    }
     return true;
 }
 
-template <int Ops = 8, int Repeat = 1'000'000>
+template <int Collisions, int Shift>
+struct test_hash
+{
+    auto operator()(int key) const -> std::uint64_t
+    {
+        return std::uint64_t(key / Collisions) << Shift;
+    }
+};
+
+// the keys of the ops, with the number of the op as value, loaded in one
+// batch on top of every tenth key inserted before, must end up as if they
+// were inserted in order, the later of equal keys winning, for lookup and
+// lookup_many alike.
+template <int Collisions, int Shift, class Array>
+auto bulk_load_once_test(Array const& ops) -> bool
+{
+    concurrent::trie<int, int, test_hash<Collisions, Shift>> t;
+    std::unordered_map<int, int> um;
+    std::vector<std::pair<int, int>> batch;
+    for (auto i = 0; i < static_cast<int>(ops.size()); i++) {
+        auto key = ops[i].second;
+        if (i % 10 == 0) {
+            t.insert(key, -1);
+            um.emplace(key, -1);
+        }
+        batch.emplace_back(key, i);
+    }
+    for (auto [key, i] : batch)
+        um[key] = i;
+    t.bulk_load(batch, 4);
+    std::vector<int> keys;
+    for (auto [key, i] : batch)
+        keys.push_back(key);
+    std::vector<std::optional<int>> out(keys.size());
+    t.lookup_many(keys, out);
+    for (auto i = 0u; i < keys.size(); i++)
+        if (t.lookup(keys[i]) != um.at(keys[i]) || out[i] != um.at(keys[i]))
+            return false;
+    return same_keys(t, um);
+}
+
+// the image of a trie, concurrent after the ops and sequential after the
+// inserts alone, has to map with the keys of the trie, and to thaw into a
+// concurrent trie with them that takes updates. an image cut short does not
+// map.
+template <int Collisions, int Shift, class Array>
+auto image_once_test(Array const& ops) -> bool
+{
+    using hash = test_hash<Collisions, Shift>;
+    using mapped = util::mapped_trie<int, int, hash>;
+    auto path = (std::filesystem::temp_directory_path() / "single_thread_test.img").string();
+    concurrent::trie<int, int, hash> t;
+    sequential::trie<int, int, hash> s;
+    std::unordered_map<int, int> um, sm;
+    for (auto i = 0; i < static_cast<int>(ops.size()); i++) {
+        auto [op, key] = ops[i];
+        if (op == 1) {
+            t.insert(key, i);
+            s.insert(key, i);
+            um[key] = i;
+            sm[key] = i;
+        } else if (op == 2) {
+            t.remove(key);
+            um.erase(key);
+        }
+    }
+    auto same = [&](mapped const& m, std::unordered_map<int, int> const& expected) {
+        if (!m || m.keys() != expected.size() || !same_keys(m, expected))
+            return false;
+        for (auto [op, key] : ops) {
+            auto it = expected.find(key);
+            if (m.lookup(key) != (it == expected.end() ? std::nullopt : std::optional{it->second}))
+                return false;
+        }
+        return true;
+    };
+    if (!s.save(path) || !same(mapped{path}, sm))
+        return false;
+    if (!t.save(path) || !same(mapped{path}, um))
+        return false;
+    concurrent::trie<int, int, hash> thawed{mapped{path}, 2};
+    thawed.insert(-1, -1);
+    um[-1] = -1;
+    if (!same_keys(thawed, um) || thawed.lookup(-1) != -1)
+        return false;
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+    auto cut = !mapped{path};
+    std::filesystem::remove(path);
+    return cut;
+}
+
+// a raw trie, with or without its pool, against a map: inserts overwrite
+// the values of the keys there, and lookups have to agree all along. after
+// clear() no key is found, until the keys are inserted again.
+template <class Trie, class Array>
+auto raw_once_test(Array const& ops) -> bool
+{
+    Trie t;
+    std::unordered_map<int, int> um;
+    auto found = [&](int key) {
+        auto it = um.find(key);
+        return t.lookup(key) == (it == um.end() ? std::nullopt : std::optional{it->second});
+    };
+    auto same = [&] {
+        for (auto [op, key] : ops)
+            if (!found(key))
+                return false;
+        return true;
+    };
+    for (auto round = 0; round < 2; round++) {
+        for (auto i = 0; i < static_cast<int>(ops.size()); i++) {
+            auto [op, key] = ops[i];
+            if (op == 0) {
+                if (!found(key))
+                    return false;
+            } else {
+                auto value = round ? -i : i;
+                t.insert(key, value);
+                um[key] = value;
+            }
+        }
+        if (!same())
+            return false;
+        t.clear();
+        um.clear();
+        if (!same())
+            return false;
+    }
+    return true;
+}
+
+// like bulk_load_once_test, for a raw trie: the batch loaded on top of
+// every tenth key inserted before has to give the trie that inserting the
+// same keys in order gives, with the same lookups, misses among them, and
+// the same stats. lookup_many, if Many, has to agree with lookup.
+template <class Trie, bool Many, class Array>
+auto raw_bulk_load_once_test(Array const& ops) -> bool
+{
+    Trie t, inserted;
+    std::unordered_map<int, int> um;
+    std::vector<std::pair<int, int>> batch;
+    for (auto i = 0; i < static_cast<int>(ops.size()); i++) {
+        auto key = ops[i].second;
+        if (i % 10 == 0) {
+            t.insert(key, -1);
+            inserted.insert(key, -1);
+        }
+        batch.emplace_back(key, i);
+    }
+    t.bulk_load(batch, 4);
+    for (auto [key, i] : batch) {
+        inserted.insert(key, i);
+        um[key] = i;
+    }
+    // every other key is one that is not there, some of them in the lnodes
+    // of the keys that are
+    std::vector<int> keys;
+    for (auto [key, i] : batch) {
+        keys.push_back(key);
+        keys.push_back(i % 2 ? -key - 1 : key + 1);
+    }
+    std::vector<std::optional<int>> out(keys.size());
+    if constexpr (Many)
+        t.lookup_many(keys, out);
+    for (auto i = 0u; i < keys.size(); i++) {
+        std::optional<int> gt;
+        if (um.count(keys[i]))
+            gt = um.at(keys[i]);
+        if (t.lookup(keys[i]) != gt || inserted.lookup(keys[i]) != gt)
+            return false;
+        if (Many && out[i] != gt)
+            return false;
+    }
+    auto s = t.stats(), expected = inserted.stats();
+    if (s.keys != um.size() || expected.keys != um.size())
+        return false;
+    for (auto k = 0u; k < s.kinds.size(); k++)
+        if (s.kinds[k].name == "snode" || s.kinds[k].name == "lnode")
+            if (s.kinds[k].count != expected.kinds[k].count)
+                return false;
+    return true;
+}
+
+// a value that counts its instances, so that a test can tell that every
+// one made has been destroyed
+struct counted
+{
+    inline static long live = 0;
+
+    counted() { live += 1; }
+    counted(int v) : value(v) { live += 1; }
+    counted(counted const& other) : value(other.value) { live += 1; }
+    counted& operator=(counted const&) = default;
+    ~counted() { live -= 1; }
+
+    int value{0};
+};
+
+// the slab arena and the pool built on it. a merged slab keeps the objects
+// of both, and what is freed is made again before a chunk grows. a pool
+// that is cleared gives every node back, takes them again for the same
+// inserts without growing, and destroys every value, of its leaves and of
+// their lnode chains, when it goes.
+template <int Collisions, int Shift, class Array>
+auto slab_once_test(Array const& ops) -> bool
+{
+    {
+        util::slab<counted> a, b;
+        std::vector<counted*> made;
+        for (auto [op, key] : ops)
+            made.push_back((op ? a : b).make(key));
+        auto n = made.size();
+        a.merge(std::move(b));
+        if (a.size() != n || b.size() != 0 || counted::live != static_cast<long>(n))
+            return false;
+        auto capacity = a.capacity();
+        for (auto p : made)
+            a.free(p);
+        if (a.size() != 0 || counted::live != 0)
+            return false;
+        made.clear();
+        for (auto [op, key] : ops)
+            made.push_back(a.make(key));
+        for (auto i = 0u; i < n; i++)
+            if (made[i]->value != ops[i].second)
+                return false;
+        if (a.capacity() != capacity)
+            return false;
+        for (auto p : made)
+            a.free(p);
+    }
+    if (counted::live != 0)
+        return false;
+    {
+        sequential::raw_trie_mem_pool<int, counted, test_hash<Collisions, Shift>> t;
+        std::unordered_map<int, int> um;
+        auto insert = [&] {
+            for (auto i = 0; i < static_cast<int>(ops.size()); i++) {
+                t.insert(ops[i].second, i);
+                um[ops[i].second] = i;
+            }
+            for (auto [key, value] : um)
+                if (auto v = t.lookup(key); !v || v->value != value)
+                    return false;
+            return true;
+        };
+        auto capacity = [&] {
+            return std::tuple{t.pool.leaves.capacity(), t.pool.narrows.capacity(),
+                t.pool.wides.capacity()};
+        };
+        if (!insert())
+            return false;
+        auto before = capacity();
+        t.clear();
+        if (t.pool.leaves.size() != 0 || t.pool.narrows.size() != 0 || t.pool.wides.size() != 1)
+            return false;
+        if (!insert() || capacity() != before)
+            return false;
+    }
+    return counted::live == 0;
+}
+
+template <int Ops = 8, int Repeat = 1'000'000, int Collisions = 1, int Shift = 0>
 void single_thread_test(int max = 100)
 {
     std::cout << std::string(80, '=') << "\n";
@@ -61,7 +436,7 @@ void single_thread_test(int max = 100)
     for (auto i = 0; i < Repeat; i++) {
         auto ops = generate_ops<Ops>(max);
         try {
-            if (!single_thread_once_test(ops))
+            if (!single_thread_once_test<Collisions, Shift>(ops))
                 throw std::logic_error{"bad case"};
         } catch (...) {
             std::cout << "test failed.\n";
@@ -79,9 +454,157 @@ void single_thread_test(int max = 100)
     std::cout << std::string(80, '=') << "\n";
 }
 
+template <int Ops, int Repeat, int Collisions = 1, int Shift = 0, int Every = 10'000>
+void snapshot_test(int max = 100)
+{
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: snapshot_test\n";
+
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        auto ops = generate_ops<Ops>(max);
+        if (!snapshot_once_test<Collisions, Shift, Every>(ops)) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+template <int Ops, int Repeat, int Collisions = 1, int Shift = 0>
+void bulk_load_test(int max = 100)
+{
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: bulk_load_test\n";
+
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        auto ops = generate_ops<Ops>(max);
+        if (!bulk_load_once_test<Collisions, Shift>(ops)) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+template <int Ops, int Repeat, int Collisions = 1, int Shift = 0>
+void image_test(int max = 100)
+{
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: image_test\n";
+
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        auto ops = generate_ops<Ops>(max);
+        if (!image_once_test<Collisions, Shift>(ops)) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+template <int Ops, int Repeat, int Collisions = 1, int Shift = 0>
+void raw_test(int max = 100)
+{
+    using hash = test_hash<Collisions, Shift>;
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: raw_test\n";
+
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        auto ops = generate_ops<Ops>(max);
+        if (!raw_once_test<sequential::raw_trie<int, int, hash>>(ops)
+            || !raw_once_test<sequential::raw_trie_mem_pool<int, int, hash>>(ops)) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+template <int Ops, int Repeat, int Collisions = 1, int Shift = 0>
+void raw_bulk_load_test(int max = 100)
+{
+    using hash = test_hash<Collisions, Shift>;
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: raw_bulk_load_test\n";
+
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        auto ops = generate_ops<Ops>(max);
+        if (!raw_bulk_load_once_test<sequential::raw_trie<int, int, hash>, true>(ops)
+            || !raw_bulk_load_once_test<sequential::raw_trie_mem_pool<int, int, hash>, false>(ops)) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
+
+template <int Ops, int Repeat, int Collisions = 1, int Shift = 0>
+void slab_test(int max = 100)
+{
+    std::cout << std::string(80, '=') << "\n";
+    std::cout << "testing: slab_test\n";
+
+    util::progress_display pd(Repeat);
+    for (auto i = 0; i < Repeat; i++) {
+        auto ops = generate_ops<Ops>(max);
+        if (!slab_once_test<Collisions, Shift>(ops)) {
+            std::cout << "test failed.\n";
+            std::cout << std::string(80, '=') << "\n";
+            return;
+        }
+        pd.tick();
+        pd.display(std::cout);
+    }
+    std::cout << "passed.\n";
+    std::cout << std::string(80, '=') << "\n";
+}
 
 int main()
 {
     single_thread_test<10'000'000, 10>(1<<30);
+    single_thread_test<1'000'000, 10, 20>(100'000);
+    single_thread_test<1'000'000, 10, 1, 44>(1<<20);
+    snapshot_test<200'000, 10>(10'000);
+    snapshot_test<20'000, 10, 20, 0, 100>(1'000);
+    snapshot_test<200'000, 10, 1, 44>(1<<20);
+    bulk_load_test<1'000'000, 10>(1<<30);
+    bulk_load_test<100'000, 10, 20>(10'000);
+    bulk_load_test<100'000, 10, 1, 44>(1<<20);
+    image_test<1'000'000, 4>(1<<30);
+    image_test<100'000, 10, 20>(10'000);
+    image_test<100'000, 10, 1, 44>(1<<20);
+    raw_test<1'000'000, 10>(1<<30);
+    raw_test<100'000, 10, 20>(10'000);
+    raw_test<100'000, 10, 1, 44>(1<<20);
+    raw_bulk_load_test<1'000'000, 4>(1<<30);
+    raw_bulk_load_test<100'000, 10, 20>(10'000);
+    raw_bulk_load_test<100'000, 10, 1, 44>(1<<20);
+    slab_test<100'000, 10>(1<<30);
+    slab_test<100'000, 10, 20>(10'000);
 }
 